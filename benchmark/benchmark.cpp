@@ -0,0 +1,119 @@
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <sstream>
+
+
+namespace cherry {
+namespace benchmark {
+
+namespace {
+
+std::string Quote(const std::string& value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\')
+      quoted += '\\';
+    quoted += c;
+  }
+  quoted += '"';
+  return quoted;
+}
+
+} // namespace
+
+
+// Class Result ---------------------------------------------------------------
+
+Result::Result(const std::string& name) : name_(name) {}
+
+Result& Result::Add(const std::string& key, int value) {
+  return Add(key, static_cast<int64_t>(value));
+}
+
+Result& Result::Add(const std::string& key, int64_t value) {
+  fields_.push_back(Quote(key) + ":" + std::to_string(value));
+  return *this;
+}
+
+Result& Result::Add(const std::string& key, double value) {
+  std::ostringstream stream;
+  stream << Quote(key) << ":" << value;
+  fields_.push_back(stream.str());
+  return *this;
+}
+
+Result& Result::Add(const std::string& key, const std::string& value) {
+  fields_.push_back(Quote(key) + ":" + Quote(value));
+  return *this;
+}
+
+Result& Result::AddAverage(const std::string& key, int64_t total,
+                           int64_t count) {
+  return Add(key, static_cast<double>(total) / count);
+}
+
+Result& Result::AddPercentiles(const std::string& prefix,
+                               std::vector<int64_t> samples) {
+  if (samples.empty())
+    return *this;
+  std::sort(samples.begin(), samples.end());
+  auto at = [&samples](double ratio) {
+    size_t index = static_cast<size_t>(ratio * (samples.size() - 1));
+    return samples[index];
+  };
+  Add(prefix + "_p50", at(0.50));
+  Add(prefix + "_p90", at(0.90));
+  Add(prefix + "_p99", at(0.99));
+  Add(prefix + "_max", samples.back());
+  return *this;
+}
+
+std::string Result::ToJson() const {
+  std::string json = "{" + Quote("benchmark") + ":" + Quote(name_);
+  for (const auto& field : fields_)
+    json += "," + field;
+  json += "}";
+  return json;
+}
+
+
+// Class Reporter -------------------------------------------------------------
+
+Reporter::Reporter(std::ostream& out, const std::string& filter)
+    : out_(out), filter_(filter) {}
+
+bool Reporter::ShouldRun(const std::string& name) const {
+  return filter_.empty() || name.find(filter_) != std::string::npos;
+}
+
+void Reporter::Report(const Result& result) {
+  out_ << result.ToJson() << std::endl;
+}
+
+
+// Class Latch ----------------------------------------------------------------
+
+void Latch::CountDown() {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (--count_ <= 0)
+    cv_.notify_all();
+}
+
+void Latch::Wait() {
+  std::unique_lock<std::mutex> lock(lock_);
+  cv_.wait(lock, [this] { return count_ <= 0; });
+}
+
+
+void RunOn(TaskRunner::ID id, std::function<void()> task) {
+  Latch done(1);
+  TaskRunner::PostTask(id, Callback([&task, &done]() {
+    task();
+    done.CountDown();
+  }));
+  done.Wait();
+}
+
+} // namespace benchmark
+} // namespace cherry
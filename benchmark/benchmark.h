@@ -0,0 +1,109 @@
+#ifndef BENCHMARK_BENCHMARK_H_
+#define BENCHMARK_BENCHMARK_H_
+
+#include "cherry/task_runner.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+namespace cherry {
+namespace benchmark {
+
+// Monotonic time in nanoseconds, used for all measurements.
+inline int64_t NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Class Result ---------------------------------------------------------------
+// One benchmark result, serialized as a single line JSON object.
+class Result {
+public:
+  explicit Result(const std::string& name);
+
+  Result& Add(const std::string& key, int value);
+  Result& Add(const std::string& key, int64_t value);
+  Result& Add(const std::string& key, double value);
+  Result& Add(const std::string& key, const std::string& value);
+  // Adds |key| as |total| / |count|, e.g. "ns_per_event".
+  Result& AddAverage(const std::string& key, int64_t total, int64_t count);
+
+  // Adds |prefix|_p50, _p90, _p99 and _max of |samples|.
+  Result& AddPercentiles(const std::string& prefix,
+                         std::vector<int64_t> samples);
+
+  const std::string& name() const { return name_; }
+  std::string ToJson() const;
+
+private:
+  std::string name_;
+  // Already serialized "key":value pairs.
+  std::vector<std::string> fields_;
+
+};
+
+
+// Class Reporter -------------------------------------------------------------
+// Writes results as JSON lines, so runs can be diffed between releases.
+class Reporter {
+public:
+  Reporter(std::ostream& out, const std::string& filter);
+
+  // Benchmarks whose name doesn't contain the filter are skipped.
+  bool ShouldRun(const std::string& name) const;
+  void Report(const Result& result);
+
+private:
+  std::ostream& out_;
+  std::string filter_;
+
+};
+
+
+// Class Latch ----------------------------------------------------------------
+// Blocks the driver thread until tasks running on task runners are done.
+class Latch {
+public:
+  explicit Latch(int count) : count_(count) {}
+
+  void CountDown();
+  void Wait();
+
+private:
+  std::mutex lock_;
+  std::condition_variable cv_;
+  int count_;
+
+};
+
+
+// Runs |task| on runner |id| and blocks the driver thread until it returns,
+// e.g. to subscribe on the runner which owns the subscription.
+void RunOn(TaskRunner::ID id, std::function<void()> task);
+
+
+// Suites, run on the driver thread while the task runners are alive.
+void RunTaskRunnerBenchmarks(Reporter* reporter);
+void RunEventBusBenchmarks(Reporter* reporter);
+void RunCallbackBenchmarks(Reporter* reporter);
+
+#if defined(__linux__)
+// Runs this executable again as the peer process, see RunShmPeer.
+void RunShmBenchmarks(Reporter* reporter);
+// Entry point of the peer process of the shared memory benchmark.
+int RunShmPeer(const std::string& name);
+// Records events to a journal and replays them.
+void RunJournalBenchmarks(Reporter* reporter);
+#endif
+
+} // namespace benchmark
+} // namespace cherry
+
+#endif  // BENCHMARK_BENCHMARK_H_
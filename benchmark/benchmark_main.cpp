@@ -0,0 +1,67 @@
+// Benchmarks of the cherry scheduler and event bus. Results are written to
+// stdout as JSON lines, an optional argument only runs benchmarks whose name
+// contains it, e.g. "cherry_benchmarks event_bus". "--shm-peer <name>" runs
+// the peer process of the shared memory benchmark.
+
+#include "benchmark/benchmark.h"
+
+#include "cherry/bootstrap.h"
+#include "cherry/event_macro.h"
+
+#include <iostream>
+#include <thread>
+
+using namespace cherry;
+using namespace cherry::benchmark;
+
+
+// Class BenchmarkBootstrap ---------------------------------------------------
+// Runs the suites on a driver thread, so both EVENT and IO stay free to run
+// the measured tasks.
+class BenchmarkBootstrap : public Bootstrap {
+public:
+  explicit BenchmarkBootstrap(const std::string& filter)
+      : reporter_(std::cout, filter) {}
+
+  // Bootstrap implementations
+  void OnStart() override {
+    driver_ = std::thread(&BenchmarkBootstrap::RunSuites, this);
+  }
+
+  void Join() {
+    if (driver_.joinable())
+      driver_.join();
+  }
+
+private:
+  void RunSuites() {
+    RunCallbackBenchmarks(&reporter_);
+    RunTaskRunnerBenchmarks(&reporter_);
+    RunEventBusBenchmarks(&reporter_);
+#if defined(__linux__)
+    RunShmBenchmarks(&reporter_);
+    RunJournalBenchmarks(&reporter_);
+#endif
+    // Fired from a runner, so the bus outlives the firing.
+    TaskRunner::PostTask(TaskRunner::EVENT,
+                         BindObj(this, &BenchmarkBootstrap::FireStop));
+  }
+
+  void FireStop() { EventBus::FireEvent(new Cherry_Stop); }
+
+  Reporter reporter_;
+  std::thread driver_;
+
+};
+
+int main(int argc, char* argv[]) {
+#if defined(__linux__)
+  if (argc > 2 && std::string(argv[1]) == "--shm-peer")
+    return RunShmPeer(argv[2]);
+#endif
+
+  BenchmarkBootstrap bootstrap(argc > 1 ? argv[1] : "");
+  bootstrap.Run();
+  bootstrap.Join();
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "benchmark/benchmark.h"
+
+#include "cherry/callback.h"
+
+
+namespace cherry {
+namespace benchmark {
+
+namespace {
+
+const int kIterations = 1000000;
+
+class Accumulator {
+public:
+  void Add(int value) { sum_ += value; }
+
+  int64_t sum() const { return sum_; }
+
+private:
+  volatile int64_t sum_ = 0;
+
+};
+
+volatile int64_t g_sum = 0;
+
+void AddToSum(int value) {
+  g_sum += value;
+}
+
+void ReportPerOp(Reporter* reporter, Result result, int64_t elapsed_ns) {
+  result.Add("iterations", kIterations)
+        .AddAverage("ns_per_op", elapsed_ns, kIterations);
+  reporter->Report(result);
+}
+
+void BindObjCost(Reporter* reporter) {
+  Result result("callback.bind_obj");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Accumulator accumulator;
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kIterations; ++i) {
+    Callback callback = BindObj(&accumulator, &Accumulator::Add, i);
+    (void)callback;
+  }
+  ReportPerOp(reporter, result, NowNanoseconds() - start_ns);
+}
+
+void BindObjInvokeCost(Reporter* reporter) {
+  Result result("callback.bind_obj_invoke");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Accumulator accumulator;
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kIterations; ++i)
+    BindObj(&accumulator, &Accumulator::Add, i).Run();
+  ReportPerOp(reporter, result, NowNanoseconds() - start_ns);
+}
+
+void BindInvokeCost(Reporter* reporter) {
+  Result result("callback.bind_invoke");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kIterations; ++i)
+    Bind(&AddToSum, i).Run();
+  ReportPerOp(reporter, result, NowNanoseconds() - start_ns);
+}
+
+void InvokeCost(Reporter* reporter) {
+  Result result("callback.invoke");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Accumulator accumulator;
+  Callback callback = BindObj(&accumulator, &Accumulator::Add, 1);
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kIterations; ++i)
+    callback.Run();
+  ReportPerOp(reporter, result, NowNanoseconds() - start_ns);
+}
+
+} // namespace
+
+void RunCallbackBenchmarks(Reporter* reporter) {
+  BindObjCost(reporter);
+  BindObjInvokeCost(reporter);
+  BindInvokeCost(reporter);
+  InvokeCost(reporter);
+}
+
+} // namespace benchmark
+} // namespace cherry
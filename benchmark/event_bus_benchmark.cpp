@@ -0,0 +1,1169 @@
+#include "benchmark/benchmark.h"
+
+#include "cherry/event_macro.h"
+#include "cherry/task_runner.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+
+EVENT_DEFINE1(BenchEvent, int)
+EVENT_DEFINE1(BenchIdleEvent, int)
+EVENT_DEFINE2(BenchKeyedEvent, int, int)
+EVENT_DEFINE_COALESCED(BenchStateEvent, int)
+EVENT_DEFINE1(MapEvent0, int)
+EVENT_DEFINE1(MapEvent1, int)
+EVENT_DEFINE1(MapEvent2, int)
+EVENT_DEFINE1(MapEvent3, int)
+EVENT_DEFINE1(MapEvent4, int)
+EVENT_DEFINE1(MapEvent5, int)
+EVENT_DEFINE1(MapEvent6, int)
+EVENT_DEFINE1(MapEvent7, int)
+EVENT_DEFINE_COALESCED_BY_KEY(BenchKeyedStateEvent, int, int)
+EVENT_DEFINE1(BenchControlEvent, int)
+EVENT_DEFINE_URGENT(BenchUrgentEvent, int)
+EVENT_DEFINE2(BenchTickEvent, int, double)
+EVENT_DEFINE_RPC(BenchLookup, (int), (int))
+EVENT_DEFINE2(BenchOrderEvent, int, int)
+EVENT_DEFINE1(BenchFeedEvent, int)
+EVENT_DEFINE_STICKY_BY_KEY(BenchQuoteState, int, double)
+EVENT_DEFINE2(BenchQuoteUpdate, int, double)
+EVENT_DEFINE1(BenchSnapshotEvent, std::string)
+
+
+namespace cherry {
+namespace benchmark {
+
+namespace {
+
+const int kFanOutEvents = 20000;
+
+
+// Class IdleObserver ---------------------------------------------------------
+// Observer interested in another event, it only adds dispatch overhead.
+class IdleObserver : public EventObserver {
+public:
+  virtual ~IdleObserver() {}
+
+  bool OnEvent(const Event* event) override {
+    bool handled = true;
+    BEGIN_EVENT_MAP(IdleObserver, event)
+      EVENT_HANDLER(BenchIdleEvent, OnIdle)
+      EVENT_UNHANDLED(handled = false)
+    END_EVENT_MAP()
+    return handled;
+  }
+
+  void OnIdle(int) {}
+};
+
+
+// Class SinkObserver ---------------------------------------------------------
+// Observer handling BenchEvent, registered behind the idle ones.
+class SinkObserver : public IdleObserver {
+public:
+  SinkObserver(int target, Latch* latch) : target_(target), latch_(latch) {}
+
+  bool OnEvent(const Event* event) override {
+    bool handled = true;
+    BEGIN_EVENT_MAP(SinkObserver, event)
+      EVENT_HANDLER(BenchEvent, OnBench)
+      EVENT_UNHANDLED(handled = false)
+    END_EVENT_MAP()
+    return handled;
+  }
+
+  void OnBench(int) {
+    if (++count_ == target_) {
+      end_ns_ = NowNanoseconds();
+      latch_->CountDown();
+    }
+  }
+
+  int64_t end_ns() const { return end_ns_; }
+
+private:
+  int target_;
+  Latch* latch_;
+  int count_ = 0;
+  int64_t end_ns_ = 0;
+
+};
+
+using Observers = std::vector<std::unique_ptr<IdleObserver>>;
+
+// How the observers are attached to the bus.
+enum FanOutMode {
+  // Register, every observer is offered every event in turn.
+  REGISTER,
+  // Subscribe to the ID the observer handles.
+  SUBSCRIBE_ID,
+  // Subscribe the handler method to the event type.
+  SUBSCRIBE_TYPED,
+};
+
+const char* FanOutModeName(FanOutMode mode) {
+  switch (mode) {
+    case REGISTER:
+      return "register";
+    case SUBSCRIBE_ID:
+      return "subscribe_id";
+    case SUBSCRIBE_TYPED:
+      return "subscribe_typed";
+  }
+  return "";
+}
+
+// Runs on EVENT, subscribes every observer to the event it handles, the last
+// one is the sink.
+void SubscribeObservers(Observers* observers,
+                        std::vector<SubscriptionHandle>* handles,
+                        FanOutMode mode) {
+  size_t idle_count = observers->size() - 1;
+  for (size_t i = 0; i < idle_count; ++i) {
+    IdleObserver* observer = (*observers)[i].get();
+    if (mode == SUBSCRIBE_TYPED) {
+      handles->push_back(EventBus::Subscribe<BenchIdleEvent>(
+          observer, &IdleObserver::OnIdle));
+    } else {
+      handles->push_back(EventBus::Subscribe(observer, BenchIdleEvent::ID));
+    }
+  }
+
+  SinkObserver* sink = static_cast<SinkObserver*>(observers->back().get());
+  if (mode == SUBSCRIBE_TYPED) {
+    handles->push_back(
+        EventBus::Subscribe<BenchEvent>(sink, &SinkObserver::OnBench));
+  } else {
+    handles->push_back(EventBus::Subscribe(sink, BenchEvent::ID));
+  }
+}
+
+// Unsubscribes |handles| on |runner|, which made the subscriptions.
+void UnsubscribeAll(TaskRunner::ID runner,
+                    const std::vector<SubscriptionHandle>& handles) {
+  RunOn(runner, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+}
+
+void FanOut(Reporter* reporter, int observer_count, FanOutMode mode) {
+  Result result("event_bus.fan_out");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  Observers observers;
+  for (int i = 1; i < observer_count; ++i)
+    observers.emplace_back(new IdleObserver);
+  SinkObserver* sink = new SinkObserver(kFanOutEvents, &latch);
+  observers.emplace_back(sink);
+
+  std::vector<SubscriptionHandle> handles;
+  if (mode != REGISTER) {
+    RunOn(TaskRunner::EVENT, [&observers, &handles, mode]() {
+      SubscribeObservers(&observers, &handles, mode);
+    });
+  } else {
+    for (const auto& observer : observers)
+      EventBus::Register(observer.get());
+  }
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::FireEvent(new BenchEvent(i));
+  latch.Wait();
+  int64_t elapsed_ns = sink->end_ns() - start_ns;
+
+  if (mode != REGISTER) {
+    UnsubscribeAll(TaskRunner::EVENT, handles);
+  } else {
+    RunOn(TaskRunner::EVENT, [&observers]() {
+      for (const auto& observer : observers)
+        EventBus::Unregister(observer.get());
+    });
+  }
+
+  result.Add("mode", FanOutModeName(mode))
+        .Add("observers", observer_count)
+        .Add("events", kFanOutEvents)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class Relay ----------------------------------------------------------------
+// EVENT side subscriber forwarding to an IO side sink, the pattern needed
+// before subscriptions could be affine to IO.
+class Relay {
+public:
+  explicit Relay(SinkObserver* sink) : sink_(sink) {}
+
+  void OnBench(int value) {
+    TaskRunner::PostTask(TaskRunner::IO,
+                         BindObj(sink_, &SinkObserver::OnBench, value));
+  }
+
+private:
+  SinkObserver* sink_;
+
+};
+
+// Delivers events to a handler on IO, either subscribed on IO directly or
+// relayed by a subscriber on EVENT.
+void IoDelivery(Reporter* reporter, bool affine) {
+  Result result("event_bus.io_delivery");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  SinkObserver sink(kFanOutEvents, &latch);
+  Relay relay(&sink);
+  TaskRunner::ID runner = affine ? TaskRunner::IO : TaskRunner::EVENT;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(runner, [&sink, &relay, &handle, affine]() {
+    if (affine)
+      handle = EventBus::Subscribe<BenchEvent>(&sink, &SinkObserver::OnBench);
+    else
+      handle = EventBus::Subscribe<BenchEvent>(&relay, &Relay::OnBench);
+  });
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::FireEvent(new BenchEvent(i));
+  latch.Wait();
+  int64_t elapsed_ns = sink.end_ns() - start_ns;
+
+  UnsubscribeAll(runner, { handle });
+
+  result.Add("mode", affine ? "affine" : "relay")
+        .Add("events", kFanOutEvents)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// One shared event instance delivered to every subscriber.
+void BroadcastFanOut(Reporter* reporter, int subscriber_count) {
+  Result result("event_bus.broadcast");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(subscriber_count);
+  std::vector<std::unique_ptr<SinkObserver>> sinks;
+  for (int i = 0; i < subscriber_count; ++i)
+    sinks.emplace_back(new SinkObserver(kFanOutEvents, &latch));
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&sinks, &handles]() {
+    for (const auto& sink : sinks) {
+      handles.push_back(
+          EventBus::Subscribe<BenchEvent>(sink.get(), &SinkObserver::OnBench));
+    }
+  });
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::Broadcast(new BenchEvent(i));
+  latch.Wait();
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, handles);
+
+  result.Add("subscribers", subscriber_count)
+        .Add("events", kFanOutEvents)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Runs on EVENT, fires every event from there.
+void FireFromEventRunner(int count, bool inline_dispatch, int64_t* start_ns) {
+  *start_ns = NowNanoseconds();
+  for (int i = 0; i < count; ++i) {
+    if (inline_dispatch)
+      EventBus::FireEventNow(new BenchEvent(i));
+    else
+      EventBus::FireEvent(new BenchEvent(i));
+  }
+}
+
+// Events fired by a handler on EVENT, queued or dispatched inline.
+void FireNow(Reporter* reporter, bool inline_dispatch) {
+  Result result("event_bus.fire_now");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  SinkObserver sink(kFanOutEvents, &latch);
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<BenchEvent>(&sink, &SinkObserver::OnBench);
+  });
+
+  int64_t start_ns = 0;
+  TaskRunner::PostTask(TaskRunner::EVENT,
+                       Bind(&FireFromEventRunner, kFanOutEvents,
+                            inline_dispatch, &start_ns));
+  latch.Wait();
+  int64_t elapsed_ns = sink.end_ns() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+
+  result.Add("mode", inline_dispatch ? "inline" : "queued")
+        .Add("events", kFanOutEvents)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class KeyedSink ------------------------------------------------------------
+// Handles BenchKeyedEvent for one key, either subscribed to that key or
+// subscribed to all and filtering.
+class KeyedSink : public EventObserver {
+public:
+  KeyedSink(int key, int target, Latch* latch)
+      : key_(key), target_(target), latch_(latch) {}
+
+  bool OnEvent(const Event* event) override {
+    const BenchKeyedEvent* keyed = static_cast<const BenchKeyedEvent*>(event);
+    if (std::get<0>(keyed->param()) != key_)
+      return false;
+    OnKeyed(key_, std::get<1>(keyed->param()));
+    return true;
+  }
+
+  void OnKeyed(int, int) {
+    if (++count_ == target_)
+      latch_->CountDown();
+  }
+
+  int key() const { return key_; }
+
+private:
+  int key_;
+  int target_;
+  Latch* latch_;
+  int count_ = 0;
+
+};
+
+using KeyedSinks = std::vector<std::unique_ptr<KeyedSink>>;
+
+// Events for one key among |subscriber_count| subscribers of distinct keys,
+// the one interested subscribed last.
+void KeyedFanOut(Reporter* reporter, int subscriber_count, bool keyed) {
+  Result result("event_bus.keyed");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  KeyedSinks sinks;
+  for (int i = 0; i < subscriber_count; ++i)
+    sinks.emplace_back(new KeyedSink(i, kFanOutEvents, &latch));
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&sinks, &handles, keyed]() {
+    for (const auto& sink : sinks) {
+      if (keyed) {
+        handles.push_back(EventBus::Subscribe<BenchKeyedEvent>(
+            sink->key(), sink.get(), &KeyedSink::OnKeyed));
+      } else {
+        handles.push_back(EventBus::Subscribe(sink.get(), BenchKeyedEvent::ID));
+      }
+    }
+  });
+
+  int key = subscriber_count - 1;
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::Emit<BenchKeyedEvent>(key, i);
+  latch.Wait();
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, handles);
+
+  result.Add("mode", keyed ? "keyed" : "filter")
+        .Add("subscribers", subscriber_count)
+        .Add("events", kFanOutEvents)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class ShardSink ------------------------------------------------------------
+// Handles BenchKeyedEvent with some work, possibly on several runners.
+class ShardSink {
+public:
+  ShardSink(int target, Latch* latch) : target_(target), latch_(latch) {}
+
+  void OnKeyed(int, int) {
+    int64_t end_ns = NowNanoseconds() + kShardWorkNs;
+    while (NowNanoseconds() < end_ns) {}
+    if (count_.fetch_add(1) + 1 == target_)
+      latch_->CountDown();
+  }
+
+  static const int kShardWorkNs = 1000;
+
+private:
+  int target_;
+  Latch* latch_;
+  std::atomic<int> count_{0};
+
+};
+
+// Sharded events over |keys| keys handled by one subscriber, in global order
+// on EVENT or per key on the dispatch runners.
+void Sharded(Reporter* reporter, EventBus::Ordering ordering, int keys) {
+  Result result("event_bus.sharded");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  ShardSink sink(kFanOutEvents, &latch);
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle, ordering]() {
+    handle = EventBus::Subscribe<BenchKeyedEvent>(ordering, &sink,
+                                                  &ShardSink::OnKeyed);
+  });
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::FireSharded(new BenchKeyedEvent(i % keys, i));
+  latch.Wait();
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+
+  bool global = ordering == EventBus::GLOBAL_ORDER;
+  result.Add("ordering", global ? "global" : "per_key")
+        .Add("shards", EventBus::kShardCount)
+        .Add("keys", keys)
+        .Add("events", kFanOutEvents)
+        .Add("handler_ns", ShardSink::kShardWorkNs)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class MapObserver ----------------------------------------------------------
+// Handles eight event types, through its event map when Register'ed or
+// through a typed subscription per type.
+class MapObserver : public EventObserver {
+public:
+  bool OnEvent(const Event* event) override {
+    bool handled = true;
+    BEGIN_EVENT_MAP(MapObserver, event)
+      EVENT_HANDLER(MapEvent0, OnMap)
+      EVENT_HANDLER(MapEvent1, OnMap)
+      EVENT_HANDLER(MapEvent2, OnMap)
+      EVENT_HANDLER(MapEvent3, OnMap)
+      EVENT_HANDLER(MapEvent4, OnMap)
+      EVENT_HANDLER(MapEvent5, OnMap)
+      EVENT_HANDLER(MapEvent6, OnMap)
+      EVENT_HANDLER(MapEvent7, OnMap)
+      EVENT_UNHANDLED(handled = false)
+    END_EVENT_MAP()
+    return handled;
+  }
+
+  void OnMap(int value) { sum_ += value; }
+
+  int64_t sum() const { return sum_; }
+
+private:
+  int64_t sum_ = 0;
+
+};
+
+template <typename EventType>
+void SubscribeMap(MapObserver* observer,
+                  std::vector<SubscriptionHandle>* handles) {
+  handles->push_back(
+      EventBus::Subscribe<EventType>(observer, &MapObserver::OnMap));
+}
+
+void FireMapEvent(int i) {
+  switch (i % 8) {
+    case 0: EventBus::FireEventNow(new MapEvent0(i)); break;
+    case 1: EventBus::FireEventNow(new MapEvent1(i)); break;
+    case 2: EventBus::FireEventNow(new MapEvent2(i)); break;
+    case 3: EventBus::FireEventNow(new MapEvent3(i)); break;
+    case 4: EventBus::FireEventNow(new MapEvent4(i)); break;
+    case 5: EventBus::FireEventNow(new MapEvent5(i)); break;
+    case 6: EventBus::FireEventNow(new MapEvent6(i)); break;
+    case 7: EventBus::FireEventNow(new MapEvent7(i)); break;
+  }
+}
+
+// Runs on EVENT, dispatches inline so the queue doesn't hide the lookup.
+void DispatchMapEvents(bool table, int64_t* elapsed_ns) {
+  MapObserver observer;
+  std::vector<SubscriptionHandle> handles;
+  if (table) {
+    SubscribeMap<MapEvent0>(&observer, &handles);
+    SubscribeMap<MapEvent1>(&observer, &handles);
+    SubscribeMap<MapEvent2>(&observer, &handles);
+    SubscribeMap<MapEvent3>(&observer, &handles);
+    SubscribeMap<MapEvent4>(&observer, &handles);
+    SubscribeMap<MapEvent5>(&observer, &handles);
+    SubscribeMap<MapEvent6>(&observer, &handles);
+    SubscribeMap<MapEvent7>(&observer, &handles);
+  } else {
+    EventBus::Register(&observer);
+  }
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    FireMapEvent(i);
+  *elapsed_ns = NowNanoseconds() - start_ns;
+
+  if (table) {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  } else {
+    EventBus::Unregister(&observer);
+  }
+}
+
+// Event map switch over hashed IDs against the flat per slot table of typed
+// subscriptions.
+void MapDispatch(Reporter* reporter, bool table) {
+  Result result("event_bus.map_dispatch");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  int64_t elapsed_ns = 0;
+  RunOn(TaskRunner::EVENT, [table, &elapsed_ns]() {
+    DispatchMapEvents(table, &elapsed_ns);
+  });
+
+  result.Add("mode", table ? "flat_table" : "switch_map")
+        .Add("event_types", 8)
+        .Add("events", kFanOutEvents)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class StateSink ------------------------------------------------------------
+// Counts the handler calls for a burst of state changes.
+class StateSink {
+public:
+  explicit StateSink(Latch* latch) : latch_(latch) {}
+
+  void OnState(int value) {
+    ++calls_;
+    if (value == kLastState)
+      latch_->CountDown();
+  }
+
+  void OnKeyedState(int, int value) { OnState(value); }
+
+  int calls() const { return calls_; }
+
+  static const int kLastState = -1;
+
+private:
+  Latch* latch_;
+  int calls_ = 0;
+
+};
+
+// Fires a burst of state changes and counts how many reach the handler.
+// Without coalescing each one does.
+void CoalesceBurst(Reporter* reporter, int burst, int keys) {
+  Result result("event_bus.coalesce");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(keys);
+  StateSink sink(&latch);
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle, keys]() {
+    if (keys == 1) {
+      handle = EventBus::Subscribe<BenchStateEvent>(&sink,
+                                                    &StateSink::OnState);
+    } else {
+      handle = EventBus::Subscribe<BenchKeyedStateEvent>(
+          &sink, &StateSink::OnKeyedState);
+    }
+  });
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < burst; ++i) {
+    int value = i < burst - keys ? i : StateSink::kLastState;
+    if (keys == 1)
+      EventBus::Emit<BenchStateEvent>(value);
+    else
+      EventBus::Emit<BenchKeyedStateEvent>(i % keys, value);
+  }
+  latch.Wait();
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+
+  result.Add("burst", burst)
+        .Add("keys", keys)
+        .Add("handler_calls", sink.calls())
+        .AddAverage("ns_per_event", elapsed_ns, burst);
+  reporter->Report(result);
+}
+
+// Typed subscriber dispatch with the dispatch metrics off and on, the cost
+// of timing every handler call.
+void DispatchMetrics(Reporter* reporter, bool enabled) {
+  Result result("event_bus.metrics");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  Observers observers;
+  SinkObserver* sink = new SinkObserver(kFanOutEvents, &latch);
+  observers.emplace_back(sink);
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&observers, &handles]() {
+    SubscribeObservers(&observers, &handles, SUBSCRIBE_TYPED);
+  });
+
+  EventBus::EnableMetrics(enabled);
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::FireEvent(new BenchEvent(i));
+  latch.Wait();
+  int64_t elapsed_ns = sink->end_ns() - start_ns;
+  EventBus::EnableMetrics(false);
+
+  int64_t queue_delay_ns = 0;
+  for (const EventMetrics& event : EventBus::GetMetrics().events) {
+    if (event.slot == BenchEvent::Slot() && event.dispatched > 0)
+      queue_delay_ns = event.queue_delay_ns / event.dispatched;
+  }
+
+  UnsubscribeAll(TaskRunner::EVENT, handles);
+
+  result.Add("enabled", enabled ? 1 : 0)
+        .Add("events", kFanOutEvents)
+        .Add("queue_delay_ns", queue_delay_ns)
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class ControlSink ----------------------------------------------------------
+// Handles a backlog of ordinary events and one control event fired behind
+// it, counts how much of the backlog was handled first.
+class ControlSink {
+public:
+  ControlSink(int backlog, Latch* latch) : backlog_(backlog), latch_(latch) {}
+
+  void OnBench(int) {
+    if (++handled_ == backlog_)
+      latch_->CountDown();
+  }
+
+  void OnControl(int) {
+    end_ns_ = NowNanoseconds();
+    handled_before_ = handled_;
+    latch_->CountDown();
+  }
+
+  int64_t end_ns() const { return end_ns_; }
+  int handled_before() const { return handled_before_; }
+
+private:
+  int backlog_;
+  Latch* latch_;
+  int handled_ = 0;
+  int handled_before_ = 0;
+  int64_t end_ns_ = 0;
+
+};
+
+// Latency of a control event fired behind a backlog of ordinary ones, as an
+// ordinary event or an urgent one.
+void ControlLatency(Reporter* reporter, bool urgent) {
+  Result result("event_bus.urgent");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(2);
+  ControlSink sink(kFanOutEvents, &latch);
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&sink, &handles]() {
+    handles.push_back(
+        EventBus::Subscribe<BenchEvent>(&sink, &ControlSink::OnBench));
+    handles.push_back(
+        EventBus::Subscribe<BenchControlEvent>(&sink, &ControlSink::OnControl));
+    handles.push_back(
+        EventBus::Subscribe<BenchUrgentEvent>(&sink, &ControlSink::OnControl));
+  });
+
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::FireEvent(new BenchEvent(i));
+  int64_t start_ns = NowNanoseconds();
+  if (urgent)
+    EventBus::FireEvent(new BenchUrgentEvent(0));
+  else
+    EventBus::FireEvent(new BenchControlEvent(0));
+  latch.Wait();
+
+  UnsubscribeAll(TaskRunner::EVENT, handles);
+
+  result.Add("mode", urgent ? "urgent" : "ordinary")
+        .Add("backlog", kFanOutEvents)
+        .Add("handled_before", sink.handled_before())
+        .Add("latency_ns", sink.end_ns() - start_ns);
+  reporter->Report(result);
+}
+
+// Class TickSink -------------------------------------------------------------
+// Sums the prices of BenchTickEvent, one event or one batch at a time.
+class TickSink {
+public:
+  TickSink(int target, Latch* latch) : target_(target), latch_(latch) {}
+
+  void OnTick(int, double price) {
+    sum_ += price;
+    Count(1);
+  }
+
+  void OnTicks(const EventBatch<BenchTickEvent>& ticks) {
+    const std::vector<double>& prices = ticks.column<1>();
+    double sum = 0;
+    for (size_t i = 0; i < prices.size(); ++i)
+      sum += prices[i];
+    sum_ += sum;
+    ++batches_;
+    Count(static_cast<int>(ticks.size()));
+  }
+
+  int batches() const { return batches_; }
+
+private:
+  void Count(int count) {
+    count_ += count;
+    if (count_ == target_)
+      latch_->CountDown();
+  }
+
+  int target_;
+  Latch* latch_;
+  int count_ = 0;
+  int batches_ = 0;
+  double sum_ = 0;
+
+};
+
+// Ticks handled one at a time, mode -1, or in batches with the BatchOrdering
+// |mode|.
+void BatchDispatch(Reporter* reporter, int mode) {
+  Result result("event_bus.batch");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  TickSink sink(kFanOutEvents, &latch);
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle, mode]() {
+    if (mode < 0) {
+      handle = EventBus::Subscribe<BenchTickEvent>(&sink, &TickSink::OnTick);
+    } else {
+      handle = EventBus::SubscribeBatch<BenchTickEvent>(
+          &sink, &TickSink::OnTicks,
+          static_cast<EventBus::BatchOrdering>(mode));
+    }
+  });
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::Emit<BenchTickEvent>(i, 100.0 + i % 7);
+  latch.Wait();
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+
+  const char* name = mode < 0 ? "per_event"
+                     : mode == EventBus::BATCH_AT_FIRST ? "batch_at_first"
+                                                        : "batch_at_last";
+  result.Add("mode", name)
+        .Add("events", kFanOutEvents)
+        .Add("batches", sink.batches())
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+// Class LookupServer ---------------------------------------------------------
+// Replies to BenchLookup on EVENT.
+class LookupServer {
+public:
+  int OnLookup(int key) { return key * 2; }
+};
+
+// Runs on IO, calls the next lookup from the reply to the previous one.
+void CallLookups(int remaining, Latch* latch) {
+  if (remaining == 0) {
+    latch->CountDown();
+    return;
+  }
+  EventBus::CallAsync<BenchLookup>(
+      [remaining, latch](bool, BenchLookup::Reply) {
+        CallLookups(remaining - 1, latch);
+      },
+      remaining);
+}
+
+// Round trips of a request and its reply, waited for by a future from the
+// driver or chained by reply callbacks on IO.
+void RpcRoundTrip(Reporter* reporter, bool async) {
+  Result result("event_bus.rpc");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  LookupServer server;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&server, &handle]() {
+    handle =
+        EventBus::Subscribe<BenchLookup>(&server, &LookupServer::OnLookup);
+  });
+
+  const int calls = kFanOutEvents / 4;
+  int64_t start_ns = NowNanoseconds();
+  if (async) {
+    Latch done(1);
+    TaskRunner::PostTask(TaskRunner::IO, Bind(&CallLookups, calls, &done));
+    done.Wait();
+  } else {
+    for (int i = 0; i < calls; ++i)
+      EventBus::Call<BenchLookup>(i).get();
+  }
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+
+  result.Add("mode", async ? "reply_callback" : "future")
+        .Add("calls", calls)
+        .AddAverage("ns_per_call", elapsed_ns, calls);
+  reporter->Report(result);
+}
+
+// Class OrderSink ------------------------------------------------------------
+// Counts the orders handled until the marker, key -1, arrives.
+class OrderSink {
+public:
+  explicit OrderSink(Latch* latch) : latch_(latch) {}
+
+  void OnOrder(int key, int) {
+    if (key < 0)
+      latch_->CountDown();
+    else
+      ++calls_;
+  }
+
+  int calls() const { return calls_; }
+
+private:
+  Latch* latch_;
+  int calls_ = 0;
+
+};
+
+// Keeps EVENT busy until |release| is counted down, so events pile up.
+void HoldEventRunner(Latch* held, Latch* release) {
+  held->CountDown();
+  release->Wait();
+}
+
+enum CancelMode {
+  CANCEL_NONE,
+  // Half of the keys.
+  CANCEL_KEYS,
+  CANCEL_ID,
+};
+
+// Queues a burst of events while EVENT is held, cancels some of them, then
+// times the dispatch of the burst. Canceled events are dropped before any
+// handler runs.
+void CancelPending(Reporter* reporter, CancelMode mode, int keys) {
+  Result result("event_bus.cancel");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  OrderSink sink(&latch);
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<BenchOrderEvent>(&sink, &OrderSink::OnOrder);
+  });
+
+  Latch held(1);
+  Latch release(1);
+  TaskRunner::PostTask(TaskRunner::EVENT,
+                       Bind(&HoldEventRunner, &held, &release));
+  held.Wait();
+  for (int i = 0; i < kFanOutEvents; ++i)
+    EventBus::Emit<BenchOrderEvent>(i % keys, i);
+  if (mode == CANCEL_KEYS) {
+    for (int key = 0; key < keys / 2; ++key)
+      EventBus::CancelPending<BenchOrderEvent>(key);
+  } else if (mode == CANCEL_ID) {
+    EventBus::CancelPending(BenchOrderEvent::ID);
+  }
+  EventBus::Emit<BenchOrderEvent>(-1, 0);
+
+  int64_t start_ns = NowNanoseconds();
+  release.CountDown();
+  latch.Wait();
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+
+  const char* name = mode == CANCEL_NONE ? "none"
+                     : mode == CANCEL_KEYS ? "half_keys" : "event_id";
+  result.Add("mode", name)
+        .Add("events", kFanOutEvents)
+        .Add("keys", keys)
+        .Add("handler_calls", sink.calls())
+        .AddAverage("ns_per_event", elapsed_ns, kFanOutEvents);
+  reporter->Report(result);
+}
+
+const int kFeedEvents = 2000;
+const int64_t kSlowHandlerNs = 20000;
+
+// Class SlowObserver ---------------------------------------------------------
+// Laggard spending kSlowHandlerNs in each handler call, passes the events on.
+class SlowObserver : public EventObserver {
+public:
+  bool OnEvent(const Event* event) override {
+    if (event->GetID() == BenchFeedEvent::ID)
+      OnFeed(0);
+    return false;
+  }
+
+  void OnFeed(int) {
+    int64_t end_ns = NowNanoseconds() + kSlowHandlerNs;
+    while (NowNanoseconds() < end_ns) {}
+  }
+};
+
+// Class FeedSink -------------------------------------------------------------
+// Subscribed behind the laggard, times the arrival of the last event.
+class FeedSink {
+public:
+  explicit FeedSink(Latch* latch) : latch_(latch) {}
+
+  void OnFeed(int) {
+    if (++count_ == kFeedEvents) {
+      end_ns_ = NowNanoseconds();
+      latch_->CountDown();
+    }
+  }
+
+  int64_t end_ns() const { return end_ns_; }
+
+private:
+  Latch* latch_;
+  int count_ = 0;
+  int64_t end_ns_ = 0;
+
+};
+
+// Runs on EVENT.
+void SubscribeFeed(SlowObserver* slow, FeedSink* sink, bool isolated,
+                   std::vector<SubscriptionHandle>* handles) {
+  if (isolated) {
+    IsolationOptions options;
+    options.capacity = 64;
+    handles->push_back(EventBus::SubscribeIsolated<BenchFeedEvent>(
+        slow, &SlowObserver::OnFeed, options));
+  } else {
+    handles->push_back(EventBus::Subscribe(slow, BenchFeedEvent::ID));
+  }
+  handles->push_back(
+      EventBus::Subscribe<BenchFeedEvent>(sink, &FeedSink::OnFeed));
+}
+
+// A fast subscriber behind a slow one, which runs inline on EVENT or
+// isolated on a dispatch runner with a bounded queue.
+void SlowConsumer(Reporter* reporter, bool isolated) {
+  Result result("event_bus.isolation");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  SlowObserver slow;
+  Latch latch(1);
+  FeedSink sink(&latch);
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&slow, &sink, isolated, &handles]() {
+    SubscribeFeed(&slow, &sink, isolated, &handles);
+  });
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kFeedEvents; ++i)
+    EventBus::Emit<BenchFeedEvent>(i);
+  latch.Wait();
+  int64_t elapsed_ns = sink.end_ns() - start_ns;
+
+  IsolatedMetrics queue;
+  for (const IsolatedMetrics& metrics : EventBus::GetMetrics().isolated)
+    queue = metrics;
+
+  UnsubscribeAll(TaskRunner::EVENT, handles);
+
+  result.Add("mode", isolated ? "isolated" : "inline")
+        .Add("events", kFeedEvents)
+        .Add("laggard_dropped", static_cast<int64_t>(queue.dropped))
+        .Add("laggard_max_lag_ns", queue.max_lag_ns)
+        .AddAverage("ns_per_event", elapsed_ns, kFeedEvents);
+  reporter->Report(result);
+}
+
+const int kQuoteKeys = 1000;
+
+// Class QuoteCache -----------------------------------------------------------
+// Late subscriber needing the state of every key.
+class QuoteCache {
+public:
+  explicit QuoteCache(Latch* latch) : latch_(latch) {}
+
+  void OnQuote(int, double) {
+    if (++count_ == kQuoteKeys) {
+      end_ns_ = NowNanoseconds();
+      latch_->CountDown();
+    }
+  }
+
+  int count() const { return count_; }
+  int64_t end_ns() const { return end_ns_; }
+
+private:
+  Latch* latch_;
+  int count_ = 0;
+  int64_t end_ns_ = 0;
+
+};
+
+// Warm-up of a subscriber made after the state of every key was fired,
+// replayed from the sticky events or fired again by the producer.
+void LateSubscriber(Reporter* reporter, bool sticky) {
+  Result result("event_bus.sticky");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  if (sticky) {
+    for (int key = 0; key < kQuoteKeys; ++key)
+      EventBus::Emit<BenchQuoteState>(key, 1.0 * key);
+  }
+
+  Latch latch(1);
+  QuoteCache cache(&latch);
+  SubscriptionHandle handle = kInvalidSubscription;
+  int64_t start_ns = NowNanoseconds();
+  RunOn(TaskRunner::EVENT, [&cache, &handle, sticky]() {
+    if (sticky) {
+      handle =
+          EventBus::Subscribe<BenchQuoteState>(&cache, &QuoteCache::OnQuote);
+    } else {
+      handle =
+          EventBus::Subscribe<BenchQuoteUpdate>(&cache, &QuoteCache::OnQuote);
+    }
+  });
+  if (!sticky) {
+    for (int key = 0; key < kQuoteKeys; ++key)
+      EventBus::Emit<BenchQuoteUpdate>(key, 1.0 * key);
+  }
+  latch.Wait();
+  int64_t elapsed_ns = cache.end_ns() - start_ns;
+
+  UnsubscribeAll(TaskRunner::EVENT, { handle });
+  EventBus::ClearSticky(BenchQuoteState::ID);
+
+  result.Add("mode", sticky ? "sticky_replay" : "refire")
+        .Add("keys", kQuoteKeys)
+        .Add("handler_calls", cache.count())
+        .AddAverage("ns_per_key", elapsed_ns, kQuoteKeys);
+  reporter->Report(result);
+}
+
+const int kSnapshotEvents = 100000;
+const int kSnapshotFields = 16;
+
+// The costly part of a debug snapshot event, formatting its text.
+std::string FormatSnapshot(int sequence) {
+  std::string text;
+  for (int i = 0; i < kSnapshotFields; ++i) {
+    text += std::to_string(sequence * kSnapshotFields + i);
+    text += ',';
+  }
+  return text;
+}
+
+// Fires snapshot events nobody subscribes to, built every time or only
+// once FireEventLazy finds a subscriber. Includes the EVENT runner
+// discarding the eager events.
+void LazyFire(Reporter* reporter, bool lazy) {
+  Result result("event_bus.lazy");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  int built = 0;
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kSnapshotEvents; ++i) {
+    if (lazy) {
+      EventBus::FireEventLazy<BenchSnapshotEvent>([i, &built]() {
+        ++built;
+        return new BenchSnapshotEvent(FormatSnapshot(i));
+      });
+    } else {
+      ++built;
+      EventBus::Emit<BenchSnapshotEvent>(FormatSnapshot(i));
+    }
+  }
+  RunOn(TaskRunner::EVENT, []() {});
+  int64_t elapsed_ns = NowNanoseconds() - start_ns;
+
+  result.Add("mode", lazy ? "lazy" : "eager")
+        .Add("events", kSnapshotEvents)
+        .Add("built", built)
+        .AddAverage("ns_per_event", elapsed_ns, kSnapshotEvents);
+  reporter->Report(result);
+}
+
+} // namespace
+
+void RunEventBusBenchmarks(Reporter* reporter) {
+  for (FanOutMode mode : {REGISTER, SUBSCRIBE_ID, SUBSCRIBE_TYPED}) {
+    for (int observers : {1, 10, 50, 200})
+      FanOut(reporter, observers, mode);
+  }
+  IoDelivery(reporter, false);
+  IoDelivery(reporter, true);
+  for (int subscribers : {1, 10, 50})
+    BroadcastFanOut(reporter, subscribers);
+  for (bool keyed : {false, true}) {
+    for (int subscribers : {1, 10, 100, 1000})
+      KeyedFanOut(reporter, subscribers, keyed);
+  }
+  Sharded(reporter, EventBus::GLOBAL_ORDER, 64);
+  Sharded(reporter, EventBus::PER_KEY_ORDER, 64);
+  MapDispatch(reporter, false);
+  MapDispatch(reporter, true);
+  FireNow(reporter, false);
+  FireNow(reporter, true);
+  CoalesceBurst(reporter, 10000, 1);
+  CoalesceBurst(reporter, 10000, 16);
+  DispatchMetrics(reporter, false);
+  DispatchMetrics(reporter, true);
+  ControlLatency(reporter, false);
+  ControlLatency(reporter, true);
+  BatchDispatch(reporter, -1);
+  BatchDispatch(reporter, EventBus::BATCH_AT_FIRST);
+  BatchDispatch(reporter, EventBus::BATCH_AT_LAST);
+  RpcRoundTrip(reporter, false);
+  RpcRoundTrip(reporter, true);
+  for (CancelMode mode : {CANCEL_NONE, CANCEL_KEYS, CANCEL_ID})
+    CancelPending(reporter, mode, 64);
+  SlowConsumer(reporter, false);
+  SlowConsumer(reporter, true);
+  LateSubscriber(reporter, false);
+  LateSubscriber(reporter, true);
+  LazyFire(reporter, false);
+  LazyFire(reporter, true);
+}
+
+} // namespace benchmark
+} // namespace cherry
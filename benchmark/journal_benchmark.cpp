@@ -0,0 +1,123 @@
+#include "benchmark/benchmark.h"
+
+#include "cherry/event_journal.h"
+#include "cherry/event_macro.h"
+#include "cherry/task_runner.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+
+EVENT_DEFINE2(JournalTick, int, double)
+
+
+namespace cherry {
+namespace benchmark {
+
+namespace {
+
+const int kJournalEvents = 100000;
+const size_t kJournalSegmentSize = 1 << 20;
+
+
+// Class TickSink -------------------------------------------------------------
+// Counts down the latch when the last tick arrives.
+class TickSink {
+public:
+  void Reset(Latch* latch) {
+    latch_ = latch;
+    received_ = 0;
+  }
+
+  void OnTick(int, double) {
+    if (++received_ == kJournalEvents)
+      latch_->CountDown();
+  }
+
+private:
+  Latch* latch_ = nullptr;
+  int received_ = 0;
+
+};
+
+void RemoveJournal(const std::string& directory) {
+  for (unsigned index = 0;; ++index) {
+    char name[32];
+    snprintf(name, sizeof(name), "/events.%06u.journal", index);
+    if (unlink((directory + name).c_str()) != 0)
+      break;
+  }
+  rmdir(directory.c_str());
+}
+
+// Records a burst of events to a journal, then replays it as fast as
+// possible.
+void JournalRecordReplay(Reporter* reporter) {
+  if (!reporter->ShouldRun("event_bus.journal"))
+    return;
+
+  std::string directory = "/tmp/cherry_journal_" + std::to_string(getpid());
+  std::unique_ptr<EventJournal> journal =
+      EventJournal::Create(directory, kJournalSegmentSize);
+  if (!journal)
+    return;
+
+  TickSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  // The sink handles the ticks on EVENT, the journal records them as they
+  // are fired.
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<JournalTick>(&sink, &TickSink::OnTick);
+  });
+  journal->Record<JournalTick>();
+
+  Latch recorded(1);
+  sink.Reset(&recorded);
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 0; i < kJournalEvents; ++i)
+    EventBus::Emit<JournalTick>(i, 0.5 * i);
+  recorded.Wait();
+  int64_t record_ns = NowNanoseconds() - start_ns;
+  uint64_t dropped = journal->dropped();
+
+  journal.reset();
+
+  JournalReplayer replayer(directory);
+  replayer.Replay<JournalTick>();
+  Latch replayed(1);
+  sink.Reset(&replayed);
+  start_ns = NowNanoseconds();
+  uint64_t fired = replayer.Run(JournalReplayer::MAX_SPEED);
+  if (fired == static_cast<uint64_t>(kJournalEvents))
+    replayed.Wait();
+  int64_t replay_ns = NowNanoseconds() - start_ns;
+
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+  RemoveJournal(directory);
+
+  Result record("event_bus.journal");
+  record.Add("mode", "record")
+        .Add("events", kJournalEvents)
+        .Add("dropped", static_cast<int64_t>(dropped))
+        .AddAverage("ns_per_event", record_ns, kJournalEvents);
+  reporter->Report(record);
+
+  Result replay("event_bus.journal");
+  replay.Add("mode", "replay")
+        .Add("events", static_cast<int64_t>(fired))
+        .AddAverage("ns_per_event", replay_ns, kJournalEvents);
+  reporter->Report(replay);
+}
+
+} // namespace
+
+void RunJournalBenchmarks(Reporter* reporter) {
+  JournalRecordReplay(reporter);
+}
+
+} // namespace benchmark
+} // namespace cherry
@@ -0,0 +1,197 @@
+#include "benchmark/benchmark.h"
+
+#include "cherry/bootstrap.h"
+#include "cherry/event_macro.h"
+#include "cherry/event_transport.h"
+#include "cherry/task_runner.h"
+
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+
+EVENT_DEFINE2(ShmPing, int, double)
+EVENT_DEFINE2(ShmPong, int, double)
+
+
+namespace cherry {
+namespace benchmark {
+
+namespace {
+
+const int kShmRoundTrips = 2000;
+const int kShmEvents = 20000;
+const size_t kShmCapacity = 1 << 22;
+
+// Sequence number asking the peer to stop.
+const int kStopSequence = -1;
+
+
+// Class PongSink -------------------------------------------------------------
+// Counts the pongs coming back from the peer.
+class PongSink {
+public:
+  void OnPong(int sequence, double) {
+    last_.store(sequence, std::memory_order_release);
+    received_.fetch_add(1, std::memory_order_release);
+  }
+
+  void WaitFor(int sequence) const {
+    while (last_.load(std::memory_order_acquire) != sequence)
+      std::this_thread::yield();
+  }
+
+  void WaitForCount(int count) const {
+    while (received_.load(std::memory_order_acquire) < count)
+      std::this_thread::yield();
+  }
+
+  void Reset() { received_.store(0); }
+
+private:
+  std::atomic<int> last_{kStopSequence};
+  std::atomic<int> received_{0};
+
+};
+
+// Runs on EVENT, where the pong sink subscribed.
+void DisconnectPinger(std::unique_ptr<EventTransport>* transport,
+                      SubscriptionHandle handle) {
+  RunOn(TaskRunner::EVENT, [transport, handle]() {
+    EventBus::Unsubscribe(handle);
+    transport->reset();
+  });
+}
+
+// Runs this executable again as the peer.
+bool SpawnPeer(const std::string& name, pid_t* pid) {
+  std::string self = "/proc/self/exe";
+  std::string flag = "--shm-peer";
+  char* argv[] = { const_cast<char*>(self.c_str()),
+                   const_cast<char*>(flag.c_str()),
+                   const_cast<char*>(name.c_str()),
+                   nullptr };
+  return posix_spawn(pid, self.c_str(), nullptr, nullptr, argv, environ) == 0;
+}
+
+// Pings a peer process through an EventTransport, one at a time for the
+// round trip latency, then in a burst for the throughput.
+void ShmTransport(Reporter* reporter) {
+  if (!reporter->ShouldRun("event_bus.shm"))
+    return;
+
+  std::string name = "/cherry_bench_" + std::to_string(getpid());
+  std::unique_ptr<EventTransport> transport =
+      EventTransport::Create(name, kShmCapacity);
+  if (!transport)
+    return;
+
+  PongSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  // EVENT encodes the pings and handles the pongs.
+  RunOn(TaskRunner::EVENT, [&transport, &sink, &handle]() {
+    transport->Forward<ShmPing>();
+    transport->Receive<ShmPong>();
+    handle = EventBus::Subscribe<ShmPong>(&sink, &PongSink::OnPong);
+  });
+  transport->Start();
+
+  pid_t pid = 0;
+  if (!SpawnPeer(name, &pid)) {
+    DisconnectPinger(&transport, handle);
+    return;
+  }
+
+  // The first round trip waits for the peer to start.
+  EventBus::Emit<ShmPing>(0, 0.0);
+  sink.WaitFor(0);
+
+  int64_t start_ns = NowNanoseconds();
+  for (int i = 1; i <= kShmRoundTrips; ++i) {
+    EventBus::Emit<ShmPing>(i, 0.0);
+    sink.WaitFor(i);
+  }
+  int64_t round_trip_ns = NowNanoseconds() - start_ns;
+
+  sink.Reset();
+  start_ns = NowNanoseconds();
+  for (int i = 0; i < kShmEvents; ++i)
+    EventBus::Emit<ShmPing>(i, 0.0);
+  sink.WaitForCount(kShmEvents);
+  int64_t burst_ns = NowNanoseconds() - start_ns;
+
+  EventBus::Emit<ShmPing>(kStopSequence, 0.0);
+  int status = 0;
+  waitpid(pid, &status, 0);
+
+  DisconnectPinger(&transport, handle);
+
+  Result latency("event_bus.shm");
+  latency.Add("mode", "round_trip")
+         .Add("events", kShmRoundTrips)
+         .AddAverage("ns_per_event", round_trip_ns, kShmRoundTrips);
+  reporter->Report(latency);
+
+  Result throughput("event_bus.shm");
+  throughput.Add("mode", "burst")
+            .Add("events", kShmEvents)
+            .AddAverage("ns_per_event", burst_ns, kShmEvents);
+  reporter->Report(throughput);
+}
+
+
+// Class PeerBootstrap --------------------------------------------------------
+// The peer process, answers every ping with a pong.
+class PeerBootstrap : public Bootstrap {
+public:
+  explicit PeerBootstrap(const std::string& name) : name_(name) {}
+
+  // Bootstrap implementations
+  void OnStart() override {
+    transport_ = EventTransport::Open(name_);
+    if (!transport_) {
+      EventBus::FireEvent(new Cherry_Stop);
+      return;
+    }
+    transport_->Forward<ShmPong>();
+    transport_->Receive<ShmPing>();
+    handle_ = EventBus::Subscribe<ShmPing>(this, &PeerBootstrap::OnPing);
+    transport_->Start();
+  }
+
+private:
+  void OnPing(int sequence, double value) {
+    if (sequence != kStopSequence) {
+      EventBus::Emit<ShmPong>(sequence, value);
+      return;
+    }
+    EventBus::Unsubscribe(handle_);
+    transport_.reset();
+    EventBus::FireEvent(new Cherry_Stop);
+  }
+
+  std::string name_;
+  std::unique_ptr<EventTransport> transport_;
+  SubscriptionHandle handle_ = kInvalidSubscription;
+
+};
+
+} // namespace
+
+void RunShmBenchmarks(Reporter* reporter) {
+  ShmTransport(reporter);
+}
+
+int RunShmPeer(const std::string& name) {
+  PeerBootstrap bootstrap(name);
+  bootstrap.Run();
+  return 0;
+}
+
+} // namespace benchmark
+} // namespace cherry
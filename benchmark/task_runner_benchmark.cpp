@@ -0,0 +1,233 @@
+#include "benchmark/benchmark.h"
+
+#include "cherry/task_runner.h"
+
+#include <memory>
+#include <thread>
+
+
+namespace cherry {
+namespace benchmark {
+
+namespace {
+
+const int kThroughputTasks = 200000;
+const int kTasksPerProducer = 50000;
+const int kPingPongRounds = 20000;
+const int kDelayedTasks = 200;
+
+
+// Class TaskCounter ----------------------------------------------------------
+// Counts tasks run on a single runner, releases |latch| after the last one.
+class TaskCounter {
+public:
+  TaskCounter(int target, Latch* latch) : target_(target), latch_(latch) {}
+
+  void Tick() {
+    if (++count_ == target_) {
+      end_ns_ = NowNanoseconds();
+      latch_->CountDown();
+    }
+  }
+
+  int64_t end_ns() const { return end_ns_; }
+
+private:
+  int target_;
+  Latch* latch_;
+  int count_ = 0;
+  int64_t end_ns_ = 0;
+
+};
+
+
+// Class PingPong -------------------------------------------------------------
+// Bounces a task EVENT -> IO -> EVENT and records every round trip.
+class PingPong {
+public:
+  PingPong(int rounds, bool use_channels, Latch* latch)
+      : rounds_(rounds), use_channels_(use_channels), latch_(latch) {
+    samples_.reserve(rounds);
+  }
+
+  void Ping() {
+    start_ns_ = NowNanoseconds();
+    Post(TaskRunner::EVENT, TaskRunner::IO, BindObj(this, &PingPong::Pong));
+  }
+
+  void Pong() {
+    Post(TaskRunner::IO, TaskRunner::EVENT, BindObj(this, &PingPong::Back));
+  }
+
+  void Back() {
+    samples_.push_back(NowNanoseconds() - start_ns_);
+    if (static_cast<int>(samples_.size()) < rounds_)
+      Ping();
+    else
+      latch_->CountDown();
+  }
+
+  const std::vector<int64_t>& samples() const { return samples_; }
+
+private:
+  void Post(TaskRunner::ID from, TaskRunner::ID to, Callback callback) {
+    if (use_channels_ &&
+        TaskRunner::PostChannelTask(from, to, std::move(callback))) {
+      return;
+    }
+    TaskRunner::PostTask(to, std::move(callback));
+  }
+
+  int rounds_;
+  bool use_channels_;
+  Latch* latch_;
+  int64_t start_ns_ = 0;
+  std::vector<int64_t> samples_;
+
+};
+
+
+// Class DelayedProbe ---------------------------------------------------------
+class DelayedProbe {
+public:
+  DelayedProbe(int64_t expected_ns, Latch* latch)
+      : expected_ns_(expected_ns), latch_(latch) {}
+
+  void Fire() {
+    lateness_ns_ = NowNanoseconds() - expected_ns_;
+    latch_->CountDown();
+  }
+
+  int64_t lateness_ns() const { return lateness_ns_; }
+
+private:
+  int64_t expected_ns_;
+  Latch* latch_;
+  int64_t lateness_ns_ = 0;
+
+};
+
+
+void ReportThroughput(Reporter* reporter, Result result,
+                      int tasks, int64_t elapsed_ns) {
+  result.Add("tasks", tasks)
+        .AddAverage("ns_per_task", elapsed_ns, tasks)
+        .Add("tasks_per_sec", tasks * 1e9 / elapsed_ns);
+  reporter->Report(result);
+}
+
+void PostRunThroughput(Reporter* reporter, int batch_size) {
+  Result result("task_runner.post_run_throughput");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(1);
+  TaskCounter counter(kThroughputTasks, &latch);
+  int64_t start_ns = NowNanoseconds();
+  if (batch_size <= 1) {
+    for (int i = 0; i < kThroughputTasks; ++i) {
+      TaskRunner::PostTask(TaskRunner::IO,
+                           BindObj(&counter, &TaskCounter::Tick));
+    }
+  } else {
+    for (int i = 0; i < kThroughputTasks; i += batch_size) {
+      std::vector<Callback> batch;
+      batch.reserve(batch_size);
+      for (int j = i; j < i + batch_size && j < kThroughputTasks; ++j)
+        batch.push_back(BindObj(&counter, &TaskCounter::Tick));
+      TaskRunner::PostTasks(TaskRunner::IO, std::move(batch));
+    }
+  }
+  latch.Wait();
+
+  result.Add("batch_size", batch_size);
+  ReportThroughput(reporter, result, kThroughputTasks,
+                   counter.end_ns() - start_ns);
+}
+
+void ProducerContention(Reporter* reporter, int producers) {
+  Result result("task_runner.producer_contention");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  const int total = producers * kTasksPerProducer;
+  Latch latch(1);
+  TaskCounter counter(total, &latch);
+  int64_t start_ns = NowNanoseconds();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < producers; ++i) {
+    threads.emplace_back([&counter] {
+      for (int n = 0; n < kTasksPerProducer; ++n) {
+        TaskRunner::PostTask(TaskRunner::IO,
+                             BindObj(&counter, &TaskCounter::Tick));
+      }
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+  latch.Wait();
+
+  result.Add("producers", producers);
+  ReportThroughput(reporter, result, total, counter.end_ns() - start_ns);
+}
+
+void PingPongLatency(Reporter* reporter, bool use_channels) {
+  Result result("task_runner.ping_pong_latency");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  if (use_channels) {
+    TaskRunner::OpenChannel(TaskRunner::EVENT, TaskRunner::IO, 1024);
+    TaskRunner::OpenChannel(TaskRunner::IO, TaskRunner::EVENT, 1024);
+  }
+
+  Latch latch(1);
+  PingPong ping_pong(kPingPongRounds, use_channels, &latch);
+  TaskRunner::PostTask(TaskRunner::EVENT, BindObj(&ping_pong, &PingPong::Ping));
+  latch.Wait();
+
+  result.Add("transport", use_channels ? "channel" : "queue")
+        .Add("rounds", kPingPongRounds)
+        .AddPercentiles("round_trip_ns", ping_pong.samples());
+  reporter->Report(result);
+}
+
+void DelayedTaskAccuracy(Reporter* reporter) {
+  Result result("task_runner.delayed_task_accuracy");
+  if (!reporter->ShouldRun(result.name()))
+    return;
+
+  Latch latch(kDelayedTasks);
+  std::vector<std::unique_ptr<DelayedProbe>> probes;
+  for (int i = 0; i < kDelayedTasks; ++i) {
+    TimeDelta delay = TimeDelta::FromMilliseconds(1 + i % 20);
+    int64_t expected_ns = NowNanoseconds() + delay.Microseconds() * 1000;
+    probes.emplace_back(new DelayedProbe(expected_ns, &latch));
+    TaskRunner::PostDelayedTask(
+        TaskRunner::IO, BindObj(probes.back().get(), &DelayedProbe::Fire),
+        delay);
+  }
+  latch.Wait();
+
+  std::vector<int64_t> lateness;
+  for (const auto& probe : probes)
+    lateness.push_back(probe->lateness_ns());
+  result.Add("tasks", kDelayedTasks)
+        .AddPercentiles("lateness_ns", lateness);
+  reporter->Report(result);
+}
+
+} // namespace
+
+void RunTaskRunnerBenchmarks(Reporter* reporter) {
+  PostRunThroughput(reporter, 1);
+  PostRunThroughput(reporter, 64);
+  for (int producers : {1, 2, 4, 8})
+    ProducerContention(reporter, producers);
+  PingPongLatency(reporter, false);
+  PingPongLatency(reporter, true);
+  DelayedTaskAccuracy(reporter);
+}
+
+} // namespace benchmark
+} // namespace cherry
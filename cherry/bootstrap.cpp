@@ -11,24 +11,18 @@ namespace cherry {
 void Bootstrap::Run() {
   EventBus::Initialize();
   cherry::TaskRunner::RunAll(BindObj(this, &Bootstrap::Initialize));
-  EventBus::Unregister(this);
+  EventBus::Unsubscribe(stop_tap_);
   EventBus::Uninitialize();
 }
 
 void Bootstrap::Initialize() {
-  EventBus::Register(this);
+  // Taps run on the firing thread, the runners are stopped from EVENT.
+  stop_tap_ = EventBus::AddTap(Cherry_Stop::ID, [this](const Event*) {
+    TaskRunner::PostTask(TaskRunner::EVENT, BindObj(this, &Bootstrap::Stop));
+  });
   OnStart();
 }
 
-bool Bootstrap::OnEvent(const Event* event) {
-  bool handled = true;
-  BEGIN_EVENT_MAP(Bootstrap, event)
-    EVENT_HANDLER(Cherry_Stop, Stop)
-    EVENT_UNHANDLED(handled = false)
-  END_EVENT_MAP()
-  return handled;
-}
-
 void Bootstrap::Stop() {
   TaskRunner::StopAll();
 }
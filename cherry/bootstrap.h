@@ -6,7 +6,10 @@
 
 namespace cherry {
 
-class Bootstrap : public EventObserver {
+// Runs the task runners until Cherry_Stop is fired, whatever the subscribers
+// of Cherry_Stop return. Cherry_Stop must be fired from a task runner, the
+// bus is destroyed once they stop.
+class Bootstrap {
 public:
   Bootstrap() = default;
   virtual ~Bootstrap() {}
@@ -16,12 +19,13 @@ public:
 
   virtual void OnStart() = 0;
 
-  // EventObserver implementation
-  bool OnEvent(const Event* event);
-
 private:
   void Stop();
 
+  // A tap gets Cherry_Stop whatever its subscribers return, and unlike a
+  // Register'ed observer doesn't make every event type look subscribed.
+  SubscriptionHandle stop_tap_ = kInvalidSubscription;
+
 };
 
 } // namespace cherry
@@ -2,9 +2,216 @@
 
 #include "cherry/task_runner.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
 
 namespace cherry {
 
+namespace {
+
+// Event types known to the process, slots are indexes of |names|.
+struct EventTypes {
+  std::mutex lock;
+  std::unordered_map<int, int> slots;
+  std::vector<const char*> names;
+  // EventT::TypeTag of the type registered in each slot.
+  std::vector<const void*> types;
+
+  // Called under |lock|.
+  int SlotOf(int event_id) {
+    auto result = slots.emplace(event_id, static_cast<int>(names.size()));
+    if (result.second) {
+      names.push_back(nullptr);
+      types.push_back(nullptr);
+    }
+    return result.first->second;
+  }
+};
+
+EventTypes& GetEventTypes() {
+  static EventTypes types;
+  return types;
+}
+
+// Dispatch counters of an event type on one thread, written by that thread
+// only.
+struct SlotCounters {
+  std::atomic<uint64_t> fired{0};
+  std::atomic<uint64_t> dispatched{0};
+  std::atomic<uint64_t> unhandled{0};
+  std::atomic<uint64_t> canceled{0};
+  std::atomic<int64_t> queue_delay_ns{0};
+  std::atomic<int64_t> max_queue_delay_ns{0};
+  std::atomic<int64_t> handler_ns{0};
+};
+
+struct ThreadCounters {
+  SlotCounters slots[EventBus::kMaxEventSlots];
+};
+
+// Counters of the threads which fired or dispatched events while metrics
+// were on. The block of an exited thread keeps its counts and is reused by
+// the next thread.
+struct CounterBlocks {
+  std::mutex lock;
+  std::vector<std::unique_ptr<ThreadCounters>> blocks;
+  std::vector<ThreadCounters*> free_blocks;
+};
+
+CounterBlocks& GetCounterBlocks() {
+  static CounterBlocks blocks;
+  return blocks;
+}
+
+// Holds the counter block of the current thread until it exits.
+class ThreadCountersHolder {
+public:
+  ThreadCountersHolder() : counters_(nullptr) {}
+
+  ~ThreadCountersHolder() {
+    if (!counters_)
+      return;
+    CounterBlocks& blocks = GetCounterBlocks();
+    std::lock_guard<std::mutex> guard(blocks.lock);
+    blocks.free_blocks.push_back(counters_);
+  }
+
+  ThreadCounters* counters() {
+    if (counters_)
+      return counters_;
+    CounterBlocks& blocks = GetCounterBlocks();
+    std::lock_guard<std::mutex> guard(blocks.lock);
+    if (blocks.free_blocks.empty()) {
+      blocks.blocks.emplace_back(new ThreadCounters);
+      counters_ = blocks.blocks.back().get();
+    } else {
+      counters_ = blocks.free_blocks.back();
+      blocks.free_blocks.pop_back();
+    }
+    return counters_;
+  }
+
+private:
+  ThreadCounters* counters_;
+
+};
+
+SlotCounters* CurrentCounters(int slot) {
+  thread_local ThreadCountersHolder holder;
+  return &holder.counters()->slots[slot];
+}
+
+// Adds to a counter only written by the current thread, no read modify
+// write needed.
+template <typename T>
+void Accumulate(std::atomic<T>* counter, T value) {
+  counter->store(counter->load(std::memory_order_relaxed) + value,
+                 std::memory_order_relaxed);
+}
+
+// Posts the dispatch |task| of |event| to |runner|, urgent events skip the
+// work pending there.
+void PostDispatch(TaskRunner::ID runner, const Event* event, Callback task) {
+  if (event->IsUrgent())
+    TaskRunner::PostUrgentTask(runner, std::move(task));
+  else
+    TaskRunner::PostTask(runner, std::move(task));
+}
+
+// True if sticky sequence |a| is |b| or older, sequences wrap.
+bool SequenceNotAfter(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) <= 0;
+}
+
+// True if cancellation epoch |a| is older than |b|, epochs wrap.
+bool EpochBefore(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) < 0;
+}
+
+int64_t NowNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Event an observer of this thread may consume, see Event::IsConsumable.
+thread_local const Event* g_consumable_event = nullptr;
+
+// Sets the consumable event of this thread while an observer runs, nested
+// dispatches restore the outer one.
+class ConsumableScope {
+public:
+  ConsumableScope(const Event* event, bool consumable)
+      : previous_(g_consumable_event) {
+    g_consumable_event = consumable ? event : nullptr;
+  }
+
+  ~ConsumableScope() { g_consumable_event = previous_; }
+
+private:
+  const Event* previous_;
+
+};
+
+} // namespace
+
+int GetEventSlot(int event_id) {
+  EventTypes& types = GetEventTypes();
+  std::lock_guard<std::mutex> guard(types.lock);
+  return types.SlotOf(event_id);
+}
+
+int RegisterEvent(int event_id, const char* name, const void* type) {
+  EventTypes& types = GetEventTypes();
+  std::lock_guard<std::mutex> guard(types.lock);
+  int slot = types.SlotOf(event_id);
+  const void*& registered = types.types[slot];
+  // Equal names don't make equal types, they may be in other namespaces.
+  if (registered && registered != type) {
+    fprintf(stderr, "Event ID %d collision between types %s and %s\n",
+            event_id, types.names[slot], name);
+    abort();
+  }
+  registered = type;
+  types.names[slot] = name;
+  return slot;
+}
+
+const char* GetEventName(int slot) {
+  EventTypes& types = GetEventTypes();
+  std::lock_guard<std::mutex> guard(types.lock);
+  if (slot < 0 || slot >= static_cast<int>(types.names.size()))
+    return nullptr;
+  return types.names[slot];
+}
+
+
+// Class Event ----------------------------------------------------------------
+
+bool Event::IsConsumable() const {
+  return g_consumable_event == this;
+}
+
+
+// Class SubscriberQueue ------------------------------------------------------
+
+SubscriberQueue::SubscriberQueue(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)),
+      entries_(capacity_) {}
+
+void SubscriberQueue::Clear() {
+  for (; size_ > 0; --size_) {
+    Destroy(head_);
+    head_ = (head_ + 1) % capacity_;
+  }
+}
+
 
 // Class EventBus -------------------------------------------------------------
 EventBus* EventBus::s_instance = nullptr;
@@ -25,54 +232,1500 @@ void EventBus::EventBus::Uninitialize() {
 
 // static
 void EventBus::FireEvent(const Event* event) {
-  TaskRunner::PostTask(TaskRunner::EVENT,
-                       BindObj(s_instance, &EventBus::OnEvent, event));
+  StampFired(event);
+  RunTaps(event);
+  s_instance->FireBatched(event);
+  if (event->IsSticky()) {
+    s_instance->FireSticky(event);
+    return;
+  }
+  if (event->IsCoalesced()) {
+    // The bus owns the event, it is not really const.
+    s_instance->FireCoalesced(const_cast<Event*>(event));
+    return;
+  }
+  PostEvent(event);
+}
+
+// static
+bool EventBus::FireEventNow(const Event* event) {
+  assert(s_instance);
+  const Registry& registry = s_instance->registries_[TaskRunner::EVENT];
+  int slot = SlotOf(event);
+  uint32_t routes = RoutesOf(slot);
+  if (!TaskRunner::CurrentlyOn(TaskRunner::EVENT) ||
+      registry.dispatch_depth >= kMaxDispatchDepth ||
+      (routes & ~(1u << TaskRunner::EVENT)) != 0 ||
+      event->IsCoalesced() || event->IsSticky()) {
+    FireEvent(event);
+    return false;
+  }
+
+  StampFired(event);
+  RunTaps(event);
+  s_instance->FireBatched(event);
+  s_instance->OnEvent(event);
+  return true;
+}
+
+// static
+void EventBus::Broadcast(const Event* event) {
+  StampFired(event);
+  RunTaps(event);
+  s_instance->FireBatched(event);
+  uint32_t routes = RoutesOf(SlotOf(event));
+  // EVENT always takes part for the Register'ed observers.
+  PostToRunners(routes | (1u << TaskRunner::EVENT),
+                std::shared_ptr<const Event>(event), true);
+}
+
+// static
+void EventBus::FireSharded(const Event* event, uint64_t key_hash) {
+  assert(s_instance);
+  StampFired(event);
+  RunTaps(event);
+  s_instance->FireBatched(event);
+  std::shared_ptr<const Event> shared(event);
+  int slot = SlotOf(event);
+  // The dispatch runners may not even run without sharded subscribers.
+  bool sharded = slot < kMaxEventSlots &&
+      s_instance->has_sharded_[slot].load(std::memory_order_acquire);
+  // Counted before PostToRunners lets any runner dispatch the event.
+  if (sharded)
+    event->dispatchers_.fetch_add(1, std::memory_order_relaxed);
+  PostToRunners(RoutesOf(slot), shared, false);
+  if (sharded) {
+    TaskRunner::ID shard = static_cast<TaskRunner::ID>(
+        TaskRunner::DISPATCH_FIRST + key_hash % kShardCount);
+    PostDispatch(shard, event,
+                 BindObj(s_instance, &EventBus::OnShardedEvent, shard,
+                         shared));
+  }
+}
+
+// static
+CancelToken EventBus::FireCancelable(const Event* event) {
+  CancelToken token = MakeCancelable(event);
+  FireEvent(event);
+  return token;
+}
+
+// static
+CancelToken EventBus::BroadcastCancelable(const Event* event) {
+  CancelToken token = MakeCancelable(event);
+  Broadcast(event);
+  return token;
+}
+
+// static
+CancelToken EventBus::MakeCancelable(const Event* event) {
+  CancelToken token(std::make_shared<std::atomic<bool>>(false));
+  event->cancel_flag_ = token.flag_;
+  return token;
+}
+
+// static
+void EventBus::CancelPending(int event_id) {
+  assert(s_instance);
+  int slot = GetEventSlot(event_id);
+  if (slot >= kMaxEventSlots)
+    return;
+  std::lock_guard<std::mutex> guard(s_instance->snapshots_lock_);
+  uint32_t epoch = s_instance->cancel_epochs_[slot].fetch_add(1) + 1;
+  s_instance->canceled_before_[slot].store(epoch);
+  // The canceled keys of the slot are covered from now on.
+  if (s_instance->keyed_cancels_[slot].exchange(false)) {
+    CanceledKeys* keys = new CanceledKeys(*s_instance->canceled_keys_.load());
+    for (auto itr = keys->begin(); itr != keys->end();) {
+      if (itr->first.slot == slot)
+        itr = keys->erase(itr);
+      else
+        ++itr;
+    }
+    std::shared_ptr<void> retired(s_instance->canceled_keys_.exchange(keys));
+    s_instance->Retire({ retired });
+  }
+}
+
+// static
+void EventBus::CancelPendingKey(int slot,
+                                KeyHashFunction hash,
+                                uint64_t key) {
+  assert(s_instance);
+  if (slot >= kMaxEventSlots)
+    return;
+  std::shared_ptr<KeyCancellation> cancellation(new KeyCancellation);
+  {
+    std::lock_guard<std::mutex> guard(s_instance->snapshots_lock_);
+    uint32_t epoch = s_instance->cancel_epochs_[slot].fetch_add(1) + 1;
+    CanceledKeys* keys = new CanceledKeys(*s_instance->canceled_keys_.load());
+    (*keys)[{ slot, key }] = epoch;
+    if (!s_instance->cancel_hashes_[slot])
+      s_instance->cancel_hashes_[slot] = hash;
+    std::shared_ptr<void> retired(s_instance->canceled_keys_.exchange(keys));
+    s_instance->Retire({ retired });
+    s_instance->keyed_cancels_[slot].store(true);
+    cancellation->slot = slot;
+    cancellation->key = key;
+    cancellation->epoch = epoch;
+  }
+
+  // The events of the key fired so far are queued ahead of the markers, or
+  // merged into a pending coalesced event whose task is. The dispatch
+  // runners have none queued before they are started.
+  int runners = TaskRunner::DispatchRunnersStarted()
+                    ? TaskRunner::THREAD_COUNT
+                    : TaskRunner::DISPATCH_FIRST;
+  cancellation->markers.store(runners);
+  for (int i = 0; i < runners; ++i) {
+    TaskRunner::PostTask(static_cast<TaskRunner::ID>(i),
+                         Bind(&EventBus::PassCancelMarker, cancellation));
+  }
+}
+
+// static
+void EventBus::PassCancelMarker(
+    std::shared_ptr<KeyCancellation> cancellation) {
+  if (cancellation->markers.fetch_sub(1) == 1 && s_instance)
+    s_instance->ForgetCanceledKey(*cancellation);
+}
+
+void EventBus::ForgetCanceledKey(const KeyCancellation& cancellation) {
+  std::lock_guard<std::mutex> guard(snapshots_lock_);
+  const CanceledKeys* current = canceled_keys_.load();
+  // Canceled again meanwhile, or by CancelPending(ID).
+  auto itr = current->find({ cancellation.slot, cancellation.key });
+  if (itr == current->end() || itr->second != cancellation.epoch)
+    return;
+  CanceledKeys* keys = new CanceledKeys(*current);
+  keys->erase(itr->first);
+  int slot = cancellation.slot;
+  bool keyed = std::any_of(keys->begin(), keys->end(),
+                           [slot](const CanceledKeys::value_type& entry) {
+                             return entry.first.slot == slot;
+                           });
+  keyed_cancels_[cancellation.slot].store(keyed);
+  std::shared_ptr<void> retired(canceled_keys_.exchange(keys));
+  Retire({ retired });
+}
+
+template <typename KeyHash>
+bool EventBus::CanceledSince(TaskRunner::ID runner,
+                             int slot,
+                             uint32_t epoch,
+                             KeyHash key_hash) {
+  if (EpochBefore(epoch,
+                  canceled_before_[slot].load(std::memory_order_acquire))) {
+    return true;
+  }
+  if (!keyed_cancels_[slot].load(std::memory_order_acquire))
+    return false;
+  BeginRead(runner);
+  const CanceledKeys* keys = canceled_keys_.load();
+  auto itr = keys->find({ slot, key_hash() });
+  // CancelPending(ID) may have replaced the key meanwhile.
+  bool canceled = EpochBefore(epoch, canceled_before_[slot].load()) ||
+                  (itr != keys->end() && EpochBefore(epoch, itr->second));
+  EndRead(runner);
+  return canceled;
+}
+
+bool EventBus::DropCanceled(TaskRunner::ID runner, const Event* event) {
+  bool canceled = event->IsCanceled();
+  int slot = SlotOf(event);
+  if (slot >= kMaxEventSlots)
+    return canceled;
+
+  if (!canceled) {
+    canceled = CanceledSince(runner, slot, event->cancel_epoch_,
+                             [this, slot, event]() {
+                               return cancel_hashes_[slot](event);
+                             });
+  }
+  if (canceled && metrics_enabled())
+    Accumulate(&CurrentCounters(slot)->canceled, uint64_t(1));
+  return canceled;
+}
+
+// static
+bool EventBus::HasSubscribers(int slot) {
+  assert(s_instance);
+  // Can't tell, the event may have subscribers.
+  if (slot < 0 || slot >= kMaxEventSlots)
+    return true;
+  // Register'ed observers get every type.
+  return s_instance->observer_count_.load(std::memory_order_acquire) != 0 ||
+         RoutesOf(slot) != 0 ||
+         s_instance->has_sharded_[slot].load(std::memory_order_acquire) ||
+         s_instance->tapped_[slot].load(std::memory_order_acquire) ||
+         s_instance->ActiveBatch(slot) != nullptr;
 }
 
 // static
 void EventBus::Register(EventObserver* observer) {
   assert(s_instance);
-  TaskRunner::PostTask(TaskRunner::EVENT,
-                       BindObj(s_instance, &EventBus::AddObserver,
-                               observer));
+  s_instance->AddObserver(observer);
 }
 
 // static
 void EventBus::Unregister(EventObserver* observer) {
   assert(s_instance);
-  assert(TaskRunner::CurrentlyOn(TaskRunner::EVENT));
   s_instance->RemoveObserver(observer);
 }
 
-void EventBus::OnEvent(const Event* event) {
-  Compact();
-  for (auto observer : observers_) {
-    if (observer && observer->OnEvent(event))
+// static
+SubscriptionHandle EventBus::Subscribe(EventObserver* observer,
+                                       int event_id) {
+  assert(s_instance);
+  assert(observer);
+  return s_instance->AddSubscriber(
+      TaskRunner::CurrentID(), { GetEventSlot(event_id), false, 0 }, nullptr,
+      { observer, nullptr, kInvalidSubscription, false, nullptr, 0 });
+}
+
+// static
+SubscriptionHandle EventBus::SubscribeHandler(int slot, EventHandler handler) {
+  return AddHandler({ slot, false, 0 }, nullptr,
+                    [handler](const Event* event, bool) {
+                      handler(event);
+                      return true;
+                    });
+}
+
+// static
+SubscriptionHandle EventBus::AddHandler(const ListKey& list,
+                                        KeyHashFunction hash,
+                                        Handler handler) {
+  assert(s_instance);
+  std::unique_ptr<Handler> boxed(new Handler(std::move(handler)));
+  return s_instance->AddSubscriber(
+      TaskRunner::CurrentID(), list, hash,
+      { nullptr, std::move(boxed), kInvalidSubscription, false, nullptr, 0 });
+}
+
+// static
+void EventBus::ClearSticky(int event_id) {
+  assert(s_instance);
+  // Released once unlocked.
+  std::unordered_map<uint64_t, std::shared_ptr<const Event>> kept;
+  std::lock_guard<std::mutex> guard(s_instance->sticky_lock_);
+  auto itr = s_instance->sticky_.find(GetEventSlot(event_id));
+  if (itr != s_instance->sticky_.end()) {
+    kept.swap(itr->second);
+    s_instance->sticky_.erase(itr);
+  }
+}
+
+// static
+void EventBus::EnableMetrics(bool enabled) {
+  assert(s_instance);
+  s_instance->metrics_enabled_.store(enabled);
+}
+
+// static
+EventBusMetrics EventBus::GetMetrics() {
+  assert(s_instance);
+  EventBusMetrics metrics;
+  {
+    CounterBlocks& blocks = GetCounterBlocks();
+    std::lock_guard<std::mutex> guard(blocks.lock);
+    for (int slot = 0; slot < kMaxEventSlots; ++slot) {
+      EventMetrics event;
+      for (const auto& block : blocks.blocks) {
+        const SlotCounters& counters = block->slots[slot];
+        event.fired += counters.fired.load(std::memory_order_relaxed);
+        event.dispatched +=
+            counters.dispatched.load(std::memory_order_relaxed);
+        event.unhandled += counters.unhandled.load(std::memory_order_relaxed);
+        event.canceled += counters.canceled.load(std::memory_order_relaxed);
+        event.queue_delay_ns +=
+            counters.queue_delay_ns.load(std::memory_order_relaxed);
+        event.max_queue_delay_ns = std::max(
+            event.max_queue_delay_ns,
+            counters.max_queue_delay_ns.load(std::memory_order_relaxed));
+        event.handler_ns +=
+            counters.handler_ns.load(std::memory_order_relaxed);
+      }
+      if (event.fired == 0 && event.dispatched == 0)
+        continue;
+      event.slot = slot;
+      event.name = GetEventName(slot);
+      metrics.events.push_back(event);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(s_instance->counters_lock_);
+    for (const auto& entry : s_instance->counters_) {
+      const SubscriberCounters& counters = *entry.second;
+      SubscriberMetrics subscriber;
+      subscriber.handle = counters.handle;
+      subscriber.slot = counters.slot;
+      subscriber.calls = counters.calls.load(std::memory_order_relaxed);
+      subscriber.handler_ns =
+          counters.handler_ns.load(std::memory_order_relaxed);
+      metrics.subscribers.push_back(subscriber);
+    }
+  }
+  std::sort(metrics.subscribers.begin(), metrics.subscribers.end(),
+            [](const SubscriberMetrics& a, const SubscriberMetrics& b) {
+              return a.handle < b.handle;
+            });
+
+  {
+    std::lock_guard<std::mutex> guard(s_instance->isolated_lock_);
+    for (const auto& entry : s_instance->isolated_) {
+      SubscriberQueue* queue = entry.second.get();
+      IsolatedMetrics isolated;
+      isolated.handle = queue->handle_;
+      isolated.slot = queue->slot_;
+      isolated.runner = queue->runner_;
+      isolated.capacity = queue->capacity_;
+      std::lock_guard<std::mutex> queue_guard(queue->lock_);
+      isolated.queued = queue->size_;
+      isolated.max_queued = queue->max_queued_;
+      isolated.delivered = queue->delivered_;
+      isolated.dropped = queue->dropped_;
+      isolated.coalesced = queue->coalesced_;
+      isolated.lag_ns = queue->lag_ns_;
+      isolated.max_lag_ns = queue->max_lag_ns_;
+      metrics.isolated.push_back(isolated);
+    }
+  }
+  std::sort(metrics.isolated.begin(), metrics.isolated.end(),
+            [](const IsolatedMetrics& a, const IsolatedMetrics& b) {
+              return a.handle < b.handle;
+            });
+  return metrics;
+}
+
+// static
+void EventBus::StampFired(const Event* event) {
+  int slot = SlotOf(event);
+  if (slot >= kMaxEventSlots)
+    return;
+  event->cancel_epoch_ =
+      s_instance->cancel_epochs_[slot].load(std::memory_order_acquire);
+  if (!s_instance->metrics_enabled())
+    return;
+  event->fire_time_ = NowNanoseconds();
+  Accumulate(&CurrentCounters(slot)->fired, uint64_t(1));
+}
+
+// static
+void EventBus::CountDispatch(const Event* event,
+                             int64_t start_ns,
+                             bool handled,
+                             bool broadcast) {
+  int slot = SlotOf(event);
+  if (slot >= kMaxEventSlots)
+    return;
+  SlotCounters* counters = CurrentCounters(slot);
+  Accumulate(&counters->dispatched, uint64_t(1));
+  if (!handled && !broadcast)
+    Accumulate(&counters->unhandled, uint64_t(1));
+  // Events fired before metrics were turned on aren't stamped.
+  if (event->fire_time_ != 0) {
+    int64_t delay = start_ns - event->fire_time_;
+    Accumulate(&counters->queue_delay_ns, delay);
+    if (delay > counters->max_queue_delay_ns.load(std::memory_order_relaxed))
+      counters->max_queue_delay_ns.store(delay, std::memory_order_relaxed);
+  }
+  Accumulate(&counters->handler_ns, NowNanoseconds() - start_ns);
+}
+
+std::shared_ptr<EventBus::SubscriberCounters> EventBus::AddCounters(
+    SubscriptionHandle handle,
+    int slot) {
+  std::shared_ptr<SubscriberCounters> counters(
+      new SubscriberCounters(handle, slot));
+  std::lock_guard<std::mutex> guard(counters_lock_);
+  counters_[handle] = counters;
+  return counters;
+}
+
+void EventBus::RemoveCounters(SubscriptionHandle handle) {
+  std::lock_guard<std::mutex> guard(counters_lock_);
+  counters_.erase(handle);
+}
+
+// static
+void EventBus::Unsubscribe(SubscriptionHandle handle) {
+  assert(s_instance);
+  if (handle >= 0 && (handle & kShardedHandleBit))
+    s_instance->RemoveShardedSubscriber(handle);
+  else if (handle >= 0 && (handle & kBatchHandleBit))
+    s_instance->RemoveBatchSubscriber(handle);
+  else if (handle >= 0 && (handle & kIsolatedHandleBit))
+    s_instance->RemoveIsolatedSubscriber(handle);
+  else if (handle >= 0 && (handle & kTapHandleBit))
+    s_instance->RemoveTap(handle);
+  else
+    s_instance->RemoveSubscriber(handle);
+}
+
+// static
+SubscriptionHandle EventBus::AddBatchHandler(int slot,
+                                             BatchFactory factory,
+                                             BatchOrdering ordering,
+                                             BatchHandler handler) {
+  static_assert(kMaxEventSlots <= (1 << kBatchSlotBits),
+                "Batch handles must hold the slot");
+  assert(s_instance);
+  if (slot < 0 || slot >= kMaxEventSlots)
+    return kInvalidSubscription;
+  TaskRunner::ID runner = TaskRunner::CurrentID();
+  BatchQueue* queue = s_instance->batches_[slot].load();
+  if (!queue) {
+    std::lock_guard<std::mutex> guard(s_instance->batches_lock_);
+    queue = s_instance->batches_[slot].load();
+    if (!queue) {
+      queue = new BatchQueue;
+      queue->pending.reset(factory());
+      queue->dispatching.reset(factory());
+      s_instance->batches_[slot].store(queue);
+    }
+  }
+
+  if (queue->subscribers.empty()) {
+    queue->ordering = ordering;
+    queue->runner = runner;
+  }
+  assert(queue->runner == runner && queue->ordering == ordering);
+  // Serials wrap below kBatchHandleBit.
+  SubscriptionHandle serial = s_instance->next_batch_handle_++ &
+               ((kBatchHandleBit >> kBatchSlotBits) - 1);
+  SubscriptionHandle handle =
+      kBatchHandleBit | (serial << kBatchSlotBits) | slot;
+  queue->subscribers.push_back({ std::move(handler), handle, false });
+  queue->active.store(true);
+  return handle;
+}
+
+void EventBus::RemoveBatchSubscriber(SubscriptionHandle handle) {
+  int slot = handle & ((1 << kBatchSlotBits) - 1);
+  BatchQueue* queue = batches_[slot].load();
+  if (!queue)
+    return;
+  assert(TaskRunner::CurrentlyOn(queue->runner));
+  std::vector<BatchSubscriber>& subscribers = queue->subscribers;
+  auto itr = std::find_if(subscribers.begin(), subscribers.end(),
+                          [handle](const BatchSubscriber& subscriber) {
+                            return subscriber.handle == handle;
+                          });
+  if (itr == subscribers.end() || itr->removed)
+    return;
+  // The handler may be running, it is released after the dispatch.
+  itr->removed = true;
+  if (!queue->in_dispatch)
+    subscribers.erase(itr);
+
+  bool live = std::any_of(subscribers.begin(), subscribers.end(),
+                          [](const BatchSubscriber& subscriber) {
+                            return !subscriber.removed;
+                          });
+  if (!live) {
+    queue->active.store(false);
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->pending->Clear();
+  }
+}
+
+EventBus::BatchQueue* EventBus::ActiveBatch(int slot) const {
+  if (slot >= kMaxEventSlots)
+    return nullptr;
+  BatchQueue* queue = batches_[slot].load(std::memory_order_acquire);
+  if (!queue || !queue->active.load(std::memory_order_acquire))
+    return nullptr;
+  return queue;
+}
+
+void EventBus::FireBatched(const Event* event) {
+  int slot = SlotOf(event);
+  BatchQueue* queue = ActiveBatch(slot);
+  if (!queue)
+    return;
+
+  uint64_t sequence = 0;
+  bool first = false;
+  {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->pending->Append(event);
+    sequence = ++queue->appended;
+    first = queue->pending->size() == 1;
+    if (first && queue->ordering == BATCH_AT_LAST)
+      queue->first_ns = NowNanoseconds();
+  }
+
+  if (first || queue->ordering == BATCH_AT_LAST) {
+    TaskRunner::PostTask(queue->runner,
+                         BindObj(this, &EventBus::OnBatch, slot, sequence));
+  }
+}
+
+void EventBus::OnBatch(int slot, uint64_t sequence) {
+  BatchQueue* queue = batches_[slot].load();
+  {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    // Waits for the last event, unless the batch is full or old enough.
+    if (queue->ordering == BATCH_AT_LAST && sequence != queue->appended &&
+        queue->pending->size() < kMaxBatchEvents &&
+        NowNanoseconds() - queue->first_ns < kMaxBatchDelayNs) {
+      return;
+    }
+    if (queue->pending->size() == 0)
+      return;
+    // Events fired from now on start a new batch.
+    queue->pending.swap(queue->dispatching);
+  }
+
+  // Subscribers added by a handler get the next batch.
+  std::vector<BatchSubscriber>& subscribers = queue->subscribers;
+  size_t count = subscribers.size();
+  queue->in_dispatch = true;
+  for (size_t i = 0; i < count; ++i) {
+    if (!subscribers[i].removed)
+      subscribers[i].handler(*queue->dispatching);
+  }
+  queue->in_dispatch = false;
+  queue->dispatching->Clear();
+  subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+                                   [](const BatchSubscriber& subscriber) {
+                                     return subscriber.removed;
+                                   }),
+                    subscribers.end());
+}
+
+// static
+SubscriptionHandle EventBus::AddIsolatedHandler(
+    int slot,
+    std::shared_ptr<SubscriberQueue> queue,
+    const IsolationOptions& options) {
+  assert(s_instance);
+  if (slot >= kMaxEventSlots)
+    return kInvalidSubscription;
+  TaskRunner::ID runner = options.runner;
+  if (runner >= TaskRunner::THREAD_COUNT) {
+    runner = static_cast<TaskRunner::ID>(
+        TaskRunner::DISPATCH_FIRST +
+        s_instance->next_isolated_runner_++ % kShardCount);
+  }
+  if (runner >= TaskRunner::DISPATCH_FIRST)
+    TaskRunner::StartDispatchRunners();
+  queue->overflow_ = options.overflow;
+  queue->runner_ = runner;
+  queue->slot_ = slot;
+
+  // Whatever the subscribers do with the event.
+  SubscriptionHandle handle = AddSlotTap(
+      slot, [queue](const Event* event) { QueueIsolated(queue, event); });
+  handle |= kIsolatedHandleBit;
+  queue->handle_ = handle;
+  std::lock_guard<std::mutex> guard(s_instance->isolated_lock_);
+  s_instance->isolated_[handle] = std::move(queue);
+  return handle;
+}
+
+void EventBus::RemoveIsolatedSubscriber(SubscriptionHandle handle) {
+  std::shared_ptr<SubscriberQueue> queue;
+  {
+    std::lock_guard<std::mutex> guard(isolated_lock_);
+    auto itr = isolated_.find(handle);
+    if (itr == isolated_.end())
+      return;
+    queue = std::move(itr->second);
+    isolated_.erase(itr);
+  }
+  RemoveTap(handle & ~kIsolatedHandleBit);
+
+  std::unique_lock<std::mutex> guard(queue->lock_);
+  queue->closed_ = true;
+  queue->Clear();
+  // The handler may be the caller.
+  if (!TaskRunner::CurrentlyOn(queue->runner_))
+    queue->idle_.wait(guard, [&queue]() { return !queue->delivering_; });
+}
+
+// static
+void EventBus::QueueIsolated(const std::shared_ptr<SubscriberQueue>& queue,
+                             const Event* event) {
+  int64_t now_ns = NowNanoseconds();
+  bool coalesce = queue->overflow_ == IsolationOptions::COALESCE;
+  uint64_t key = coalesce ? queue->KeyOf(event) : 0;
+  size_t capacity = queue->capacity_;
+  {
+    std::lock_guard<std::mutex> guard(queue->lock_);
+    if (queue->closed_)
+      return;
+    if (coalesce) {
+      for (size_t i = 0; i < queue->size_; ++i) {
+        size_t index = (queue->head_ + i) % capacity;
+        if (queue->entries_[index].key == key &&
+            queue->SameKey(index, event)) {
+          // Keeps the place, and the lag, of the queued event.
+          queue->Destroy(index);
+          queue->Store(index, event);
+          queue->entries_[index].cancel_flag = event->cancel_flag_;
+          queue->entries_[index].cancel_epoch = event->cancel_epoch_;
+          ++queue->coalesced_;
+          return;
+        }
+      }
+    }
+    if (queue->size_ == capacity) {
+      ++queue->dropped_;
+      if (queue->overflow_ == IsolationOptions::DROP_NEWEST)
+        return;
+      queue->Destroy(queue->head_);
+      queue->head_ = (queue->head_ + 1) % capacity;
+      --queue->size_;
+    }
+    size_t index = (queue->head_ + queue->size_) % capacity;
+    queue->Store(index, event);
+    queue->entries_[index] = { key, now_ns, event->cancel_flag_,
+                               event->cancel_epoch_ };
+    ++queue->size_;
+    queue->max_queued_ = std::max(queue->max_queued_, queue->size_);
+    if (queue->scheduled_)
+      return;
+    queue->scheduled_ = true;
+  }
+  TaskRunner::PostTask(queue->runner_, Bind(&EventBus::DrainIsolated, queue));
+}
+
+// static
+void EventBus::DrainIsolated(std::shared_ptr<SubscriberQueue> queue) {
+  std::unique_lock<std::mutex> guard(queue->lock_);
+  // Gives the other tasks of the runner a turn after a full queue.
+  size_t budget = queue->capacity_;
+  while (queue->size_ > 0 && !queue->closed_) {
+    if (budget-- == 0) {
+      guard.unlock();
+      TaskRunner::PostTask(queue->runner_,
+                           Bind(&EventBus::DrainIsolated, queue));
+      return;
+    }
+    size_t index = queue->head_;
+    SubscriberQueue::Entry& entry = queue->entries_[index];
+    // Queued by a tap when fired, the event may be canceled since.
+    bool canceled =
+        (entry.cancel_flag && entry.cancel_flag->load()) ||
+        s_instance->CanceledSince(queue->runner_, queue->slot_,
+                                  entry.cancel_epoch, [&queue, index]() {
+                                    return queue->CancelKeyOf(index);
+                                  });
+    entry.cancel_flag.reset();
+    if (canceled) {
+      queue->Destroy(index);
+      queue->head_ = (index + 1) % queue->capacity_;
+      --queue->size_;
+      if (s_instance->metrics_enabled())
+        Accumulate(&CurrentCounters(queue->slot_)->canceled, uint64_t(1));
+      continue;
+    }
+    queue->Take(index);
+    int64_t lag_ns = NowNanoseconds() - queue->entries_[index].queued_ns;
+    queue->lag_ns_ += lag_ns;
+    queue->max_lag_ns_ = std::max(queue->max_lag_ns_, lag_ns);
+    queue->head_ = (index + 1) % queue->capacity_;
+    --queue->size_;
+    ++queue->delivered_;
+    queue->delivering_ = true;
+    guard.unlock();
+
+    queue->DeliverTaken();
+
+    guard.lock();
+    queue->delivering_ = false;
+    if (queue->closed_)
+      queue->idle_.notify_all();
+  }
+  queue->scheduled_ = false;
+}
+
+EventBus::EventBus()
+    : observers_(new ObserverSnapshot(0)),
+      observer_count_(0),
+      sharded_(new ShardedSnapshot),
+      epoch_(1),
+      next_batch_handle_(0),
+      canceled_keys_(new CanceledKeys),
+      next_isolated_runner_(0),
+      metrics_enabled_(false) {
+  for (int i = 0; i < kMaxEventSlots; ++i) {
+    routes_[i].store(0, std::memory_order_relaxed);
+    batches_[i].store(nullptr, std::memory_order_relaxed);
+    has_sharded_[i].store(false, std::memory_order_relaxed);
+    tapped_[i].store(false, std::memory_order_relaxed);
+    cancel_epochs_[i].store(0, std::memory_order_relaxed);
+    canceled_before_[i].store(0, std::memory_order_relaxed);
+    keyed_cancels_[i].store(false, std::memory_order_relaxed);
+    cancel_hashes_[i] = nullptr;
+  }
+  for (int i = 0; i < TaskRunner::THREAD_COUNT; ++i) {
+    reader_epochs_[i].store(0, std::memory_order_relaxed);
+    reader_depths_[i] = 0;
+  }
+}
+
+EventBus::~EventBus() {
+  for (const auto& pending : coalesced_)
+    delete pending.second;
+  for (int i = 0; i < kMaxEventSlots; ++i)
+    delete batches_[i].load();
+  delete observers_.load();
+  delete sharded_.load();
+  delete canceled_keys_.load();
+}
+
+// static
+void EventBus::PostEvent(const Event* event) {
+  uint32_t routes = RoutesOf(SlotOf(event));
+
+  // Events no other runner subscribes take the plain path on EVENT.
+  if ((routes & ~(1u << TaskRunner::EVENT)) == 0) {
+    PostDispatch(TaskRunner::EVENT, event,
+                 BindObj(s_instance, &EventBus::OnEvent, event));
+    return;
+  }
+
+  PostToRunners(routes | ObserverRoute(), std::shared_ptr<const Event>(event),
+                false);
+}
+
+void EventBus::FireCoalesced(Event* event) {
+  PendingKey key = { SlotOf(event), event->CoalesceKey() };
+  bool inserted = false;
+  bool merged = false;
+  {
+    std::lock_guard<std::mutex> guard(coalesce_lock_);
+    auto result = coalesced_.emplace(key, event);
+    inserted = result.second;
+    if (!inserted && event->CoalescesWith(result.first->second)) {
+      event->MergeInto(result.first->second);
+      // The merged event is canceled by what would cancel |event|.
+      result.first->second->cancel_epoch_ = event->cancel_epoch_;
+      result.first->second->cancel_flag_ = std::move(event->cancel_flag_);
+      merged = true;
+    }
+  }
+
+  if (merged) {
+    delete event;
+  } else if (inserted) {
+    TaskRunner::PostTask(TaskRunner::EVENT,
+                         BindObj(this, &EventBus::OnCoalescedEvent,
+                                 key.slot, key.key));
+  } else {
+    // Another key with the same hash is pending, don't coalesce.
+    PostEvent(event);
+  }
+}
+
+void EventBus::FireSticky(const Event* event) {
+  int slot = SlotOf(event);
+  std::shared_ptr<const Event> shared(event);
+  std::shared_ptr<const Event> replaced;
+  {
+    std::lock_guard<std::mutex> guard(sticky_lock_);
+    // 0 stands for none.
+    if (++sticky_sequence_ == 0)
+      ++sticky_sequence_;
+    event->sticky_sequence_ = sticky_sequence_;
+    std::shared_ptr<const Event>& kept = sticky_[slot][event->StickyKey()];
+    replaced = std::move(kept);
+    kept = shared;
+  }
+
+  uint32_t routes = RoutesOf(slot);
+  if ((routes & ~(1u << TaskRunner::EVENT)) == 0) {
+    PostDispatch(TaskRunner::EVENT, event,
+                 BindObj(this, &EventBus::OnStickyEvent, shared));
+  } else {
+    PostToRunners(routes | ObserverRoute(), shared, false);
+  }
+}
+
+void EventBus::ReplaySticky(TaskRunner::ID runner,
+                            SubscriptionHandle handle) {
+  Registry* registry = &registries_[runner];
+  Subscriber* subscriber = FindSubscriber(registry, handle);
+  if (!subscriber)
+    return;
+  int slot = registry->handles[HandleLocal(handle)].list.slot;
+  std::vector<std::shared_ptr<const Event>> events;
+  {
+    std::lock_guard<std::mutex> guard(sticky_lock_);
+    auto itr = sticky_.find(slot);
+    if (itr == sticky_.end())
+      return;
+    // A keyed subscriber skips the other keys itself.
+    for (const auto& kept : itr->second)
+      events.push_back(kept.second);
+    // The queued events fired until now are older than the kept ones.
+    subscriber->replayed = sticky_sequence_;
+  }
+
+  ++registry->dispatch_depth;
+  for (const auto& event : events) {
+    // The handler may unsubscribe, or subscribe and move the list.
+    subscriber = FindSubscriber(registry, handle);
+    if (!subscriber)
       break;
+    if (event->IsCanceled())
+      continue;
+    if (subscriber->handler) {
+      Handler* handler = subscriber->handler.get();
+      (*handler)(event.get(), false);
+    } else {
+      subscriber->observer->OnEvent(event.get());
+    }
+  }
+  EndDispatch(registry);
+}
+
+void EventBus::OnCoalescedEvent(int slot, uint64_t key) {
+  Event* event = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(coalesce_lock_);
+    auto itr = coalesced_.find({ slot, key });
+    assert(itr != coalesced_.end());
+    event = itr->second;
+    coalesced_.erase(itr);
+  }
+
+  uint32_t routes = RoutesOf(slot);
+  if ((routes & ~(1u << TaskRunner::EVENT)) == 0)
+    OnEvent(event);
+  else
+    PostToRunners(routes | ObserverRoute(), std::shared_ptr<const Event>(event),
+                  false);
+}
+
+// static
+void EventBus::PostToRunners(uint32_t routes,
+                             const std::shared_ptr<const Event>& event,
+                             bool broadcast) {
+  int runners = 0;
+  for (int i = 0; i < TaskRunner::THREAD_COUNT; ++i) {
+    if (routes & (1u << i))
+      ++runners;
   }
+  // Posting publishes the count.
+  event->dispatchers_.fetch_add(runners, std::memory_order_relaxed);
+  for (int i = 0; i < TaskRunner::THREAD_COUNT; ++i) {
+    if (routes & (1u << i)) {
+      TaskRunner::ID runner = static_cast<TaskRunner::ID>(i);
+      PostDispatch(runner, event.get(),
+                   BindObj(s_instance, &EventBus::OnRoutedEvent, runner,
+                           event, broadcast));
+    }
+  }
+}
+
+// static
+int EventBus::SlotOf(const Event* event) {
+  int slot = event->slot();
+  if (slot == kUnknownEventSlot)
+    slot = GetEventSlot(event->GetID());
+  return slot;
+}
+
+// static
+uint32_t EventBus::RoutesOf(int slot) {
+  if (slot >= kMaxEventSlots)
+    return 0;
+  return s_instance->routes_[slot].load(std::memory_order_acquire);
+}
+
+// static
+uint32_t EventBus::ObserverRoute() {
+  if (s_instance->observer_count_.load(std::memory_order_acquire) == 0)
+    return 0;
+  return 1u << TaskRunner::EVENT;
+}
+
+void EventBus::OnEvent(const Event* event) {
+  // The first handler consumes the event.
+  DispatchOnEvent(event, true);
   delete event;
 }
 
+void EventBus::OnStickyEvent(std::shared_ptr<const Event> event) {
+  DispatchOnEvent(event.get(), false);
+}
+
+void EventBus::DispatchOnEvent(const Event* event, bool owned) {
+  if (DropCanceled(TaskRunner::EVENT, event))
+    return;
+  Registry* registry = &registries_[TaskRunner::EVENT];
+  ++registry->dispatch_depth;
+  bool timed = metrics_enabled();
+  int64_t start_ns = timed ? NowNanoseconds() : 0;
+  bool observers = observer_count_.load(std::memory_order_acquire) != 0;
+  bool handled = DispatchToSubscribers(registry, event, false, owned,
+                                       observers) ||
+                 DispatchToObservers(event, false, owned);
+  if (timed)
+    CountDispatch(event, start_ns, handled, false);
+  EndDispatch(registry);
+}
+
+void EventBus::OnRoutedEvent(TaskRunner::ID runner,
+                             std::shared_ptr<const Event> event,
+                             bool broadcast) {
+  if (DropCanceled(runner, event.get())) {
+    event->dispatchers_.fetch_sub(1, std::memory_order_acq_rel);
+    return;
+  }
+  Registry* registry = &registries_[runner];
+  ++registry->dispatch_depth;
+  bool timed = metrics_enabled();
+  int64_t start_ns = timed ? NowNanoseconds() : 0;
+  // Other runners may still read the event until they are done with it, a
+  // sticky one is kept for replay.
+  bool owned = !broadcast && !event->IsSticky() &&
+               event->dispatchers_.load(std::memory_order_acquire) == 1;
+  // The observers come after the subscribers of EVENT, as on the plain path.
+  bool observers =
+      runner == TaskRunner::EVENT &&
+      observer_count_.load(std::memory_order_acquire) != 0;
+  bool handled = DispatchToSubscribers(registry, event.get(), broadcast,
+                                       owned, observers);
+  if (observers && (broadcast || !handled))
+    handled |= DispatchToObservers(event.get(), broadcast, owned);
+  if (timed)
+    CountDispatch(event.get(), start_ns, handled, broadcast);
+  EndDispatch(registry);
+  // Lets the runner dispatching the event last consume it.
+  event->dispatchers_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool EventBus::DispatchToSubscribers(Registry* registry,
+                                     const Event* event,
+                                     bool broadcast,
+                                     bool owned,
+                                     bool observers_follow) {
+  int slot = SlotOf(event);
+  if (slot >= static_cast<int>(registry->subscribers.size()))
+    return false;
+
+  bool handled = false;
+  SubscriberList* list = &registry->subscribers[slot];
+  bool last_consumes = owned && !observers_follow;
+  KeyedIndex& index = registry->keyed[slot];
+  if (!index.lists.empty()) {
+    // Lists stay in place when the map grows.
+    auto itr = index.lists.find(index.hash(event));
+    if (itr != index.lists.end()) {
+      bool list_empty = list->subscribers.size() == list->removed;
+      handled = DispatchToList(&itr->second, event, broadcast,
+                               last_consumes && list_empty);
+    }
+  }
+  if (broadcast || !handled)
+    handled |= DispatchToList(list, event, broadcast, last_consumes);
+  return handled;
+}
+
+bool EventBus::DispatchToList(SubscriberList* list,
+                              const Event* event,
+                              bool broadcast,
+                              bool last_consumes) {
+  // Subscribers added while dispatching don't see this event, indexing keeps
+  // the loop valid if the array grows. |list| itself never moves.
+  std::vector<Subscriber>& subscribers = list->subscribers;
+  size_t count = subscribers.size();
+  // Index of the subscriber which may consume the event, if any.
+  size_t consumer = count;
+  if (last_consumes) {
+    for (size_t i = count; i-- > 0;) {
+      if (!subscribers[i].removed) {
+        consumer = i;
+        break;
+      }
+    }
+  }
+  bool timed = metrics_enabled();
+  bool handled = false;
+  uint32_t sticky = event->IsSticky() ? event->sticky_sequence_ : 0;
+  for (size_t i = 0; i < count && (broadcast || !handled); ++i) {
+    if (subscribers[i].removed)
+      continue;
+    // Replayed, or replaced by a replayed event.
+    if (sticky && subscribers[i].replayed &&
+        SequenceNotAfter(sticky, subscribers[i].replayed)) {
+      continue;
+    }
+    int64_t start_ns = timed ? NowNanoseconds() : 0;
+    if (subscribers[i].handler) {
+      Handler* handler = subscribers[i].handler.get();
+      handled |= (*handler)(event, i == consumer);
+    } else {
+      ConsumableScope scope(event, i == consumer);
+      handled |= subscribers[i].observer->OnEvent(event);
+    }
+    if (timed) {
+      SubscriberCounters* counters = subscribers[i].counters.get();
+      Accumulate(&counters->calls, uint64_t(1));
+      Accumulate(&counters->handler_ns, NowNanoseconds() - start_ns);
+    }
+  }
+  return handled;
+}
+
+void EventBus::OnShardedEvent(TaskRunner::ID runner,
+                              std::shared_ptr<const Event> event) {
+  if (DropCanceled(runner, event.get())) {
+    event->dispatchers_.fetch_sub(1, std::memory_order_acq_rel);
+    return;
+  }
+  bool timed = metrics_enabled();
+  int64_t start_ns = timed ? NowNanoseconds() : 0;
+  // Global order subscribers may still read the event.
+  bool owned = event->dispatchers_.load(std::memory_order_acquire) == 1;
+  int slot = SlotOf(event.get());
+  bool handled = false;
+  BeginRead(runner);
+  const ShardedSnapshot* snapshot = sharded_.load();
+  if (slot < static_cast<int>(snapshot->slots.size())) {
+    const std::vector<ShardedSubscriber*>& subscribers =
+        snapshot->slots[slot];
+    // Only the last live subscriber may consume the event.
+    ShardedSubscriber* consumer = nullptr;
+    for (size_t i = subscribers.size(); owned && i-- > 0;) {
+      if (!subscribers[i]->removed.load()) {
+        consumer = subscribers[i];
+        break;
+      }
+    }
+    for (ShardedSubscriber* subscriber : subscribers) {
+      if (subscriber->removed.load())
+        continue;
+      int64_t handler_start_ns = timed ? NowNanoseconds() : 0;
+      handled = subscriber->handler(event.get(), subscriber == consumer);
+      if (timed) {
+        SubscriberCounters* counters = subscriber->counters.get();
+        // Shared by the shards.
+        counters->calls.fetch_add(1, std::memory_order_relaxed);
+        counters->handler_ns.fetch_add(NowNanoseconds() - handler_start_ns,
+                                       std::memory_order_relaxed);
+      }
+      if (handled)
+        break;
+    }
+  }
+  EndRead(runner);
+  if (timed)
+    CountDispatch(event.get(), start_ns, handled, false);
+  event->dispatchers_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool EventBus::DispatchToObservers(const Event* event,
+                                   bool broadcast,
+                                   bool owned) {
+  // Only EVENT reads the observers.
+  BeginRead(TaskRunner::EVENT);
+  const ObserverSnapshot* snapshot = observers_.load();
+  // Index of the observer which may consume the event, if any.
+  size_t consumer = snapshot->size;
+  for (size_t i = snapshot->size; owned && i-- > 0;) {
+    if (snapshot->observers[i].load()) {
+      consumer = i;
+      break;
+    }
+  }
+  bool handled = false;
+  for (size_t i = 0; i < snapshot->size; ++i) {
+    EventObserver* observer = snapshot->observers[i].load();
+    if (!observer)
+      continue;
+    ConsumableScope scope(event, i == consumer);
+    if (observer->OnEvent(event)) {
+      handled = true;
+      if (!broadcast)
+        break;
+    }
+  }
+  EndRead(TaskRunner::EVENT);
+  return handled;
+}
+
 void EventBus::AddObserver(EventObserver* observer) {
   assert(observer);
-  assert(!HasObserver(observer));
-  observers_.push_back(observer);
+  std::lock_guard<std::mutex> guard(snapshots_lock_);
+  const ObserverSnapshot* current = observers_.load();
+  ObserverSnapshot* snapshot = new ObserverSnapshot(current->size + 1);
+  for (size_t i = 0; i < current->size; ++i) {
+    EventObserver* existing = current->observers[i].load();
+    assert(existing != observer);
+    snapshot->observers[i].store(existing, std::memory_order_relaxed);
+  }
+  snapshot->observers[current->size].store(observer,
+                                           std::memory_order_relaxed);
+  PublishObservers(snapshot);
 }
 
 void EventBus::RemoveObserver(EventObserver* observer) {
-  auto itr = std::find(observers_.begin(), observers_.end(), observer);
-  if (itr != observers_.end())
-    *itr = nullptr;
+  uint64_t epoch = 0;
+  {
+    std::lock_guard<std::mutex> guard(snapshots_lock_);
+    ObserverSnapshot* current = observers_.load();
+    ObserverSnapshot* snapshot = new ObserverSnapshot(current->size);
+    size_t size = 0;
+    for (size_t i = 0; i < current->size; ++i) {
+      EventObserver* existing = current->observers[i].load();
+      if (existing == observer) {
+        // Dispatches reading this snapshot skip it from now on.
+        current->observers[i].store(nullptr);
+      } else {
+        snapshot->observers[size++].store(existing,
+                                          std::memory_order_relaxed);
+      }
+    }
+    if (size == current->size) {
+      delete snapshot;
+      return;
+    }
+    snapshot->size = size;
+    epoch = PublishObservers(snapshot);
+  }
+
+  // A dispatch in progress on EVENT is the caller if called from a handler,
+  // it won't get back to the cleared entry.
+  WaitForReaders(epoch);
 }
 
 bool EventBus::HasObserver(const EventObserver* observer) const {
-  std::list<EventObserver*>::const_iterator itr =
-      std::find(observers_.begin(), observers_.end(), observer);
-  return itr != observers_.end();
+  std::lock_guard<std::mutex> guard(snapshots_lock_);
+  const ObserverSnapshot* current = observers_.load();
+  for (size_t i = 0; i < current->size; ++i) {
+    if (current->observers[i].load(std::memory_order_relaxed) == observer)
+      return true;
+  }
+  return false;
 }
 
-void EventBus::Compact() {
-  observers_.remove(nullptr);
+// static
+SubscriptionHandle EventBus::AddShardedHandler(int slot, Handler handler) {
+  assert(s_instance);
+  if (slot < 0 || slot >= kMaxEventSlots)
+    return kInvalidSubscription;
+  TaskRunner::StartDispatchRunners();
+  std::shared_ptr<ShardedSubscriber> subscriber(
+      new ShardedSubscriber(slot, std::move(handler)));
+  std::lock_guard<std::mutex> guard(s_instance->snapshots_lock_);
+  ShardedSnapshot* snapshot =
+      new ShardedSnapshot(*s_instance->sharded_.load());
+  if (slot >= static_cast<int>(snapshot->slots.size()))
+    snapshot->slots.resize(slot + 1);
+  snapshot->slots[slot].push_back(subscriber.get());
+  s_instance->has_sharded_[slot].store(true, std::memory_order_release);
+  SubscriptionHandle handle =
+      kShardedHandleBit | s_instance->next_sharded_handle_++;
+  subscriber->counters = s_instance->AddCounters(handle, slot);
+  s_instance->sharded_subscribers_[handle] = subscriber;
+  std::shared_ptr<void> retired(s_instance->sharded_.exchange(snapshot));
+  s_instance->Retire({ retired });
+  return handle;
+}
+
+void EventBus::RemoveShardedSubscriber(SubscriptionHandle handle) {
+  uint64_t epoch = 0;
+  {
+    std::lock_guard<std::mutex> guard(snapshots_lock_);
+    auto itr = sharded_subscribers_.find(handle);
+    if (itr == sharded_subscribers_.end())
+      return;
+    std::shared_ptr<ShardedSubscriber> subscriber = itr->second;
+    sharded_subscribers_.erase(itr);
+    // Dispatches reading the current snapshot skip it from now on.
+    subscriber->removed.store(true);
+
+    ShardedSnapshot* snapshot = new ShardedSnapshot(*sharded_.load());
+    std::vector<ShardedSubscriber*>& subscribers =
+        snapshot->slots[subscriber->slot];
+    subscribers.erase(std::find(subscribers.begin(), subscribers.end(),
+                                subscriber.get()));
+    has_sharded_[subscriber->slot].store(!subscribers.empty(),
+                                         std::memory_order_release);
+    std::shared_ptr<void> retired(sharded_.exchange(snapshot));
+    epoch = Retire({ retired, subscriber });
+  }
+  RemoveCounters(handle);
+  WaitForReaders(epoch);
+}
+
+// static
+SubscriptionHandle EventBus::AddTap(int event_id, TapHandler tap) {
+  return AddSlotTap(GetEventSlot(event_id), std::move(tap));
+}
+
+// static
+SubscriptionHandle EventBus::AddSlotTap(int slot, TapHandler tap) {
+  assert(s_instance);
+  if (slot >= kMaxEventSlots)
+    return kInvalidSubscription;
+  std::lock_guard<std::shared_timed_mutex> guard(s_instance->taps_lock_);
+  SubscriptionHandle handle =
+      kTapHandleBit | (s_instance->next_tap_handle_++ & (kTapHandleBit - 1));
+  s_instance->taps_[slot].push_back({ handle, std::move(tap) });
+  s_instance->tapped_[slot].store(true, std::memory_order_release);
+  return handle;
+}
+
+// static
+void EventBus::RunTaps(const Event* event) {
+  int slot = SlotOf(event);
+  if (slot >= kMaxEventSlots ||
+      !s_instance->tapped_[slot].load(std::memory_order_acquire)) {
+    return;
+  }
+  std::shared_lock<std::shared_timed_mutex> guard(s_instance->taps_lock_);
+  auto itr = s_instance->taps_.find(slot);
+  if (itr == s_instance->taps_.end())
+    return;
+  for (const Tap& tap : itr->second)
+    tap.handler(event);
+}
+
+void EventBus::RemoveTap(SubscriptionHandle handle) {
+  // Waits for the taps running.
+  std::lock_guard<std::shared_timed_mutex> guard(taps_lock_);
+  for (auto itr = taps_.begin(); itr != taps_.end(); ++itr) {
+    std::vector<Tap>& taps = itr->second;
+    auto tap = std::find_if(taps.begin(), taps.end(),
+                            [handle](const Tap& tap) {
+                              return tap.handle == handle;
+                            });
+    if (tap == taps.end())
+      continue;
+    taps.erase(tap);
+    if (taps.empty()) {
+      tapped_[itr->first].store(false, std::memory_order_release);
+      taps_.erase(itr);
+    }
+    return;
+  }
+}
+
+uint64_t EventBus::PublishObservers(ObserverSnapshot* snapshot) {
+  observer_count_.store(snapshot->size, std::memory_order_release);
+  std::shared_ptr<void> retired(observers_.exchange(snapshot));
+  return Retire({ retired });
+}
+
+uint64_t EventBus::Retire(
+    std::initializer_list<std::shared_ptr<void>> objects) {
+  // A reader starting after this sees the new snapshots, one that started
+  // before may still read |objects|.
+  uint64_t epoch = epoch_.fetch_add(1);
+  for (const auto& object : objects)
+    retired_.push_back({ object, epoch });
+  ReclaimSnapshots();
+  return epoch;
+}
+
+void EventBus::ReclaimSnapshots() {
+  size_t kept = 0;
+  for (size_t i = 0; i < retired_.size(); ++i) {
+    if (!ReadersPast(retired_[i].epoch))
+      retired_[kept++] = std::move(retired_[i]);
+  }
+  retired_.resize(kept);
+}
+
+void EventBus::BeginRead(TaskRunner::ID runner) {
+  if (reader_depths_[runner]++ == 0)
+    reader_epochs_[runner].store(epoch_.load());
+}
+
+void EventBus::EndRead(TaskRunner::ID runner) {
+  if (--reader_depths_[runner] == 0)
+    reader_epochs_[runner].store(0);
+}
+
+bool EventBus::ReadersPast(uint64_t epoch) const {
+  for (int i = 0; i < TaskRunner::THREAD_COUNT; ++i) {
+    uint64_t reader = reader_epochs_[i].load();
+    if (reader != 0 && reader <= epoch)
+      return false;
+  }
+  return true;
+}
+
+void EventBus::WaitForReaders(uint64_t epoch) const {
+  TaskRunner::ID current = TaskRunner::CurrentID();
+  if (current < TaskRunner::THREAD_COUNT && reader_depths_[current] > 0)
+    return;
+  while (!ReadersPast(epoch))
+    std::this_thread::yield();
+}
+
+SubscriptionHandle EventBus::AddSubscriber(TaskRunner::ID runner,
+                                           const ListKey& list,
+                                           KeyHashFunction hash,
+                                           Subscriber subscriber) {
+  int slot = list.slot;
+  assert(runner < TaskRunner::THREAD_COUNT);
+  if (slot < 0 || slot >= kMaxEventSlots)
+    return kInvalidSubscription;
+  Registry* registry = &registries_[runner];
+  int local;
+  if (registry->free_handles.empty()) {
+    local = static_cast<int>(registry->handles.size());
+    assert(local < 1 << kHandleLocalBits);
+    registry->handles.push_back(HandleEntry());
+  } else {
+    local = registry->free_handles.back();
+    registry->free_handles.pop_back();
+  }
+
+  if (slot >= static_cast<int>(registry->subscribers.size())) {
+    registry->subscribers.resize(slot + 1);
+    registry->keyed.resize(slot + 1);
+    registry->counts.resize(slot + 1);
+  }
+  SubscriberList* target = &registry->subscribers[slot];
+  if (list.keyed) {
+    registry->keyed[slot].hash = hash;
+    target = &registry->keyed[slot].lists[list.key];
+  }
+  std::vector<Subscriber>& subscribers = target->subscribers;
+  HandleEntry* entry = &registry->handles[local];
+  SubscriptionHandle handle = MakeHandle(runner, local, entry->generation);
+  entry->list = list;
+  entry->index = subscribers.size();
+  subscriber.handle = handle;
+  subscriber.counters = AddCounters(handle, slot);
+  subscribers.push_back(std::move(subscriber));
+  if (registry->counts[slot]++ == 0)
+    routes_[slot].fetch_or(1u << runner, std::memory_order_release);
+
+  bool sticky = false;
+  {
+    std::lock_guard<std::mutex> guard(sticky_lock_);
+    sticky = sticky_.count(slot) != 0;
+  }
+  // Events already queued come first, the kept ones are the latest.
+  if (sticky) {
+    TaskRunner::PostTask(runner, BindObj(this, &EventBus::ReplaySticky,
+                                         runner, handle));
+  }
+  return handle;
+}
+
+void EventBus::RemoveSubscriber(SubscriptionHandle handle) {
+  if (handle < 0)
+    return;
+  TaskRunner::ID runner = HandleRunner(handle);
+  assert(TaskRunner::CurrentlyOn(runner));
+  Registry* registry = &registries_[runner];
+  Subscriber* subscriber = FindSubscriber(registry, handle);
+  if (!subscriber)
+    return;
+  size_t local = HandleLocal(handle);
+  HandleEntry& entry = registry->handles[local];
+  SubscriberList* list = FindList(registry, entry.list);
+  // The handler may be running, it is released by CompactSubscribers.
+  subscriber->removed = true;
+  if (list->removed++ == 0)
+    registry->dirty_lists.push_back(entry.list);
+  int slot = entry.list.slot;
+  if (--registry->counts[slot] == 0)
+    routes_[slot].fetch_and(~(1u << runner), std::memory_order_release);
+  RemoveCounters(handle);
+  // A stale copy of |handle| no longer matches once the entry is reused.
+  entry.generation =
+      (entry.generation + 1) & ((1ULL << kHandleGenerationBits) - 1);
+  registry->free_handles.push_back(static_cast<int>(local));
+}
+
+// static
+EventBus::Subscriber* EventBus::FindSubscriber(Registry* registry,
+                                               SubscriptionHandle handle) {
+  size_t local = HandleLocal(handle);
+  if (local >= registry->handles.size())
+    return nullptr;
+  const HandleEntry& entry = registry->handles[local];
+  if (HandleGeneration(handle) != entry.generation)
+    return nullptr;
+  SubscriberList* list = FindList(registry, entry.list);
+  if (!list || entry.index >= list->subscribers.size())
+    return nullptr;
+  Subscriber* subscriber = &list->subscribers[entry.index];
+  if (subscriber->handle != handle || subscriber->removed)
+    return nullptr;
+  return subscriber;
+}
+
+// static
+SubscriptionHandle EventBus::MakeHandle(TaskRunner::ID runner,
+                                        size_t local,
+                                        uint64_t generation) {
+  return static_cast<SubscriptionHandle>(
+      (static_cast<uint64_t>(local)
+           << (kHandleRunnerBits + kHandleGenerationBits)) |
+      (generation << kHandleRunnerBits) | runner);
+}
+
+// static
+TaskRunner::ID EventBus::HandleRunner(SubscriptionHandle handle) {
+  return static_cast<TaskRunner::ID>(handle & ((1 << kHandleRunnerBits) - 1));
+}
+
+// static
+size_t EventBus::HandleLocal(SubscriptionHandle handle) {
+  return (handle >> (kHandleRunnerBits + kHandleGenerationBits)) &
+         ((1 << kHandleLocalBits) - 1);
+}
+
+// static
+uint64_t EventBus::HandleGeneration(SubscriptionHandle handle) {
+  return (handle >> kHandleRunnerBits) &
+         ((1ULL << kHandleGenerationBits) - 1);
+}
+
+// static
+EventBus::SubscriberList* EventBus::FindList(Registry* registry,
+                                             const ListKey& list) {
+  if (list.slot >= static_cast<int>(registry->subscribers.size()))
+    return nullptr;
+  if (!list.keyed)
+    return &registry->subscribers[list.slot];
+  KeyedIndex& index = registry->keyed[list.slot];
+  auto itr = index.lists.find(list.key);
+  return itr != index.lists.end() ? &itr->second : nullptr;
+}
+
+void EventBus::EndDispatch(Registry* registry) {
+  if (--registry->dispatch_depth > 0)
+    return;
+  CompactSubscribers(registry);
+}
+
+void EventBus::CompactSubscribers(Registry* registry) {
+  for (const ListKey& key : registry->dirty_lists) {
+    SubscriberList* list = FindList(registry, key);
+    if (!list)
+      continue;
+    std::vector<Subscriber>& subscribers = list->subscribers;
+    size_t kept = 0;
+    for (size_t i = 0; i < subscribers.size(); ++i) {
+      if (subscribers[i].removed)
+        continue;
+      size_t local = HandleLocal(subscribers[i].handle);
+      registry->handles[local].index = kept;
+      if (kept != i)
+        subscribers[kept] = std::move(subscribers[i]);
+      ++kept;
+    }
+    subscribers.erase(subscribers.begin() + kept, subscribers.end());
+    list->removed = 0;
+    if (key.keyed && subscribers.empty())
+      registry->keyed[key.slot].lists.erase(key.key);
+  }
+  registry->dirty_lists.clear();
 }
 
 } // namespace cherry
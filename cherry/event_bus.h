@@ -1,44 +1,161 @@
 #ifndef CHERRY_EVENT_BUS_H_
 #define CHERRY_EVENT_BUS_H_
 
-#include <list>
+#include "cherry/event_pool.h"
+#include "cherry/task_runner.h"
+
+#include <assert.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 
 
 namespace cherry {
 
 class EventObserver;
 
-// Event dispatch helper method
+// Event dispatch helper method, returns what |method| returns.
 template <typename ObjT, typename Method, typename Tuple, size_t... Ns>
-inline void DispatchToMethodImpl(const ObjT& obj,
-                                 Method method,
-                                 Tuple&& args,
-                                 std::index_sequence<Ns...>) {
-  (obj->*method)(std::get<Ns>(std::forward<Tuple>(args))...);
+inline decltype(auto) DispatchToMethodImpl(const ObjT& obj,
+                                           Method method,
+                                           Tuple&& args,
+                                           std::index_sequence<Ns...>) {
+  return (obj->*method)(std::get<Ns>(std::forward<Tuple>(args))...);
 }
 
 template <typename ObjT, typename Method, typename Tuple>
-inline void DispatchToMethod(const ObjT& obj,
-                             Method method,
-                             Tuple&& args) {
+inline decltype(auto) DispatchToMethod(const ObjT& obj,
+                                       Method method,
+                                       Tuple&& args) {
   constexpr size_t size = std::tuple_size<std::decay_t<Tuple>>::value;
-  DispatchToMethodImpl(obj, method, std::forward<Tuple>(args),
-                       std::make_index_sequence<size>());
+  return DispatchToMethodImpl(obj, method, std::forward<Tuple>(args),
+                              std::make_index_sequence<size>());
+}
+
+
+// Compile time ID of the event named |name|, a 31 bit FNV-1a hash seeded by
+// the EVENT_START of its module. Equal names give equal IDs in every
+// translation unit, different types with equal IDs, such as equal names in
+// different namespaces, are reported by RegisterEvent at startup.
+constexpr int HashEventName(const char* name, int start) {
+  uint32_t hash = 2166136261u ^ static_cast<uint32_t>(start);
+  for (; *name; ++name) {
+    hash ^= static_cast<uint8_t>(*name);
+    hash *= 16777619u;
+  }
+  return static_cast<int>(hash & 0x7fffffff);
 }
 
+// Maps an event ID to a dense index, assigned on first use. Equal IDs share
+// a slot. Can be called on any thread.
+int GetEventSlot(int event_id);
+
+// Records |name| for |event_id| and returns its slot. |type| identifies the
+// event type, see EventT::TypeTag. Aborts if another type was recorded for
+// the ID. Called at startup by the EVENT_DEFINE macros in every translation
+// unit defining the event.
+int RegisterEvent(int event_id, const char* name, const void* type);
+
+// Name recorded for the event in |slot|, null if none.
+const char* GetEventName(int slot);
+
+const int kUnknownEventSlot = -1;
+
+// Registers an event type during static initialization.
+struct EventRegistrar {
+  EventRegistrar(int event_id, const char* name, const void* type) {
+    RegisterEvent(event_id, name, type);
+  }
+};
+
+// Selects the EventT constructor forwarding its arguments to the parameters.
+struct InPlace {};
+
 
 // Class Event ----------------------------------------------------------------
 class Event {
 public:
-  Event() : canceled_(false) {}
+  Event() : Event(kUnknownEventSlot) {}
   virtual ~Event() = default;
 
   virtual int GetID() const = 0;
-  bool IsCanceled() const { return canceled_; }
+  // True once canceled by the CancelToken it was fired with, see
+  // EventBus::FireCancelable.
+  bool IsCanceled() const {
+    return cancel_flag_ && cancel_flag_->load(std::memory_order_relaxed);
+  }
+
+  // Dense index of the event type, kUnknownEventSlot if the subclass doesn't
+  // provide it.
+  int slot() const { return slot_; }
+
+  // True while the event is offered to an observer which may move the
+  // parameters out: EventBus owns the event alone, delivers it in first
+  // handler mode and no subscriber or observer comes after this one. Only
+  // valid on the dispatching thread during EventObserver::OnEvent.
+  bool IsConsumable() const;
+
+  // True for event types defined with EVENT_DEFINE_COALESCED, see
+  // CoalescedEventT.
+  bool IsCoalesced() const { return coalesced_; }
+
+  // True for event types defined with EVENT_DEFINE_URGENT, see
+  // UrgentEventT.
+  bool IsUrgent() const { return urgent_; }
+
+  // True for event types defined with EVENT_DEFINE_STICKY, see
+  // StickyEventT.
+  bool IsSticky() const { return sticky_; }
+
+  // Hash of the key pending events are coalesced by.
+  virtual uint64_t CoalesceKey() const { return 0; }
+  // True if this event has the same key as |pending| and can be merged into
+  // it.
+  virtual bool CoalescesWith(const Event*) const { return false; }
+  // Merges this event into |pending|, which is dispatched instead.
+  virtual void MergeInto(Event*) {}
+
+  // Hash of the key the last sticky events are kept by.
+  virtual uint64_t StickyKey() const { return 0; }
+
+protected:
+  explicit Event(int slot)
+      : coalesced_(false), urgent_(false), sticky_(false), slot_(slot),
+        cancel_epoch_(0), sticky_sequence_(0), fire_time_(0),
+        dispatchers_(0) {}
+
+  void set_coalesced() { coalesced_ = true; }
+  void set_urgent() { urgent_ = true; }
+  void set_sticky() { sticky_ = true; }
 
 private:
-  bool canceled_;
+  friend class EventBus;
+
+  // Shared with the CancelToken of the event, null for the events fired
+  // without one.
+  mutable std::shared_ptr<std::atomic<bool>> cancel_flag_;
+  bool coalesced_;
+  bool urgent_;
+  bool sticky_;
+  int slot_;
+  // Cancellation epoch of the slot when fired, see EventBus::CancelPending.
+  mutable uint32_t cancel_epoch_;
+  // Order of a sticky event among those of all types, set when fired.
+  mutable uint32_t sticky_sequence_;
+  // Steady clock nanoseconds when fired, 0 unless dispatch metrics are on.
+  mutable int64_t fire_time_;
+  // Runners yet to finish dispatching the event when it is posted to
+  // several, the last one may consume it.
+  mutable std::atomic<int> dispatchers_;
 
 };
 
@@ -56,10 +173,44 @@ public:
   using Param = std::tuple<Ins...>;
   enum { ID = Meta::ID };
 
-  EventT(const Ins&... ins) : param_(ins...) {}
+  EventT(const Ins&... ins) : Event(Slot()), param_(ins...) {}
+
+  template <typename... Args>
+  explicit EventT(InPlace, Args&&... args)
+      : Event(Slot()), param_(std::forward<Args>(args)...) {}
+
+  // Events are allocated from a per type pool and recycled when deleted
+  // after dispatch.
+  static void* operator new(size_t size) {
+    if (size != sizeof(ThisType))
+      return ::operator new(size);
+    return EventPool<ThisType>::Allocate();
+  }
+
+  static void operator delete(void* block, size_t size) {
+    if (size != sizeof(ThisType))
+      ::operator delete(block);
+    else
+      EventPool<ThisType>::Release(block);
+  }
 
   int GetID() const override { return ID; }
 
+  // Slot of this event type, resolved once per type.
+  static int Slot() {
+    static const int slot = GetEventSlot(ID);
+    return slot;
+  }
+
+  // Address identifying this event type, the same in every translation
+  // unit.
+  static const void* TypeTag() {
+    static const char tag = 0;
+    return &tag;
+  }
+
+  const Param& param() const { return param_; }
+
   template <typename T, typename F>
   static void Dispatch(const Event* msg, T* obj, F func) {
 #ifdef _DEBUG
@@ -68,37 +219,1461 @@ public:
     const ThisType* this_msg = static_cast<const ThisType*>(msg);
 #endif // _DEBUG
 
-    DispatchToMethod(obj, func, this_msg->param_);
+    this_msg->DeliverTo(obj, func, msg->IsConsumable());
+  }
+
+  // Calls |func| of |obj| with the parameters. They are moved into by value
+  // parameters of |func| if |consumable|, copied otherwise. Parameters taken
+  // by const reference are never copied.
+  template <typename T, typename F>
+  void DeliverTo(T* obj, F func, bool consumable) const {
+    if (consumable) {
+      // The bus is the only owner, the event is not really const.
+      DispatchToMethod(obj, func,
+                       std::move(const_cast<ThisType*>(this)->param_));
+    } else {
+      DispatchToMethod(obj, func, param_);
+    }
   }
 
+protected:
+  Param* mutable_param() { return &param_; }
+
 private:
   Param param_;
 };
 
 
+// Class CoalescedEventT ------------------------------------------------------
+// Event template for bursty state changes. Firing an event while another one
+// of the same type, and with |kKeyed| the same first parameter, is still
+// waiting for dispatch merges it into the pending one instead of queueing
+// it, so a burst costs a single dispatch. The incoming parameters replace the
+// pending ones unless a merge function is set.
+template <typename Meta,
+          bool kKeyed,
+          typename InTuple = typename Meta::InTuple>
+class CoalescedEventT;
+
+template <typename Meta, bool kKeyed, typename... Ins>
+class CoalescedEventT<Meta, kKeyed, std::tuple<Ins...>>
+    : public EventT<Meta> {
+public:
+  using ThisType = CoalescedEventT<Meta, kKeyed, std::tuple<Ins...>>;
+  using Param = std::tuple<Ins...>;
+  // Merges |incoming| into |pending|. Runs on the firing thread with the
+  // pending events locked, it must be cheap.
+  using MergeFunction = void (*)(Param* pending, Param&& incoming);
+
+  static_assert(!kKeyed || sizeof...(Ins) > 0,
+                "Keyed events take the key as first parameter");
+
+  CoalescedEventT(const Ins&... ins) : EventT<Meta>(ins...) {
+    this->set_coalesced();
+  }
+
+  template <typename... Args>
+  explicit CoalescedEventT(InPlace, Args&&... args)
+      : EventT<Meta>(InPlace(), std::forward<Args>(args)...) {
+    this->set_coalesced();
+  }
+
+  static void SetMergeFunction(MergeFunction merge) {
+    Merge().store(merge, std::memory_order_release);
+  }
+
+  uint64_t CoalesceKey() const override {
+    return KeyHash(std::integral_constant<bool, kKeyed>());
+  }
+
+  bool CoalescesWith(const Event* pending) const override {
+    return SameKey(static_cast<const ThisType*>(pending),
+                   std::integral_constant<bool, kKeyed>());
+  }
+
+  void MergeInto(Event* pending) override {
+    Param* target = static_cast<ThisType*>(pending)->mutable_param();
+    MergeFunction merge = Merge().load(std::memory_order_acquire);
+    if (merge)
+      merge(target, std::move(*this->mutable_param()));
+    else
+      *target = std::move(*this->mutable_param());
+  }
+
+private:
+  static std::atomic<MergeFunction>& Merge() {
+    static std::atomic<MergeFunction> merge(nullptr);
+    return merge;
+  }
+
+  uint64_t KeyHash(std::false_type) const { return 0; }
+
+  uint64_t KeyHash(std::true_type) const {
+    using Key = std::decay_t<std::tuple_element_t<0, Param>>;
+    return std::hash<Key>()(std::get<0>(this->param()));
+  }
+
+  bool SameKey(const ThisType*, std::false_type) const {
+    return true;
+  }
+
+  bool SameKey(const ThisType* pending, std::true_type) const {
+    return std::get<0>(this->param()) == std::get<0>(pending->param());
+  }
+};
+
+
+// Class UrgentEventT ---------------------------------------------------------
+// Event template for control events, such as Cherry_Stop, which must not
+// wait behind ordinary ones. They are posted to the urgent lane of the
+// runners dispatching them, see TaskRunner::PostUrgentTask, and handled
+// before the events already pending there.
+template <typename Meta,
+          typename InTuple = typename Meta::InTuple>
+class UrgentEventT;
+
+template <typename Meta, typename... Ins>
+class UrgentEventT<Meta, std::tuple<Ins...>> : public EventT<Meta> {
+public:
+  UrgentEventT(const Ins&... ins) : EventT<Meta>(ins...) {
+    this->set_urgent();
+  }
+
+  template <typename... Args>
+  explicit UrgentEventT(InPlace, Args&&... args)
+      : EventT<Meta>(InPlace(), std::forward<Args>(args)...) {
+    this->set_urgent();
+  }
+};
+
+
+// Class StickyEventT ---------------------------------------------------------
+// Event template for state that subscribers made late still need. The bus
+// keeps the last event of the type fired by FireEvent or Emit, with
+// |kKeyed| the last one of each first parameter, and hands the kept events
+// to every subscriber made afterwards, so a restarted service doesn't need
+// the producers to fire their state again. The dispatched event itself is
+// kept, shared and never copied, so sticky events are never consumable. A
+// new subscriber gets the events kept when the replay task runs, and skips
+// the older ones still queued and the replayed ones.
+template <typename Meta,
+          bool kKeyed,
+          typename InTuple = typename Meta::InTuple>
+class StickyEventT;
+
+template <typename Meta, bool kKeyed, typename... Ins>
+class StickyEventT<Meta, kKeyed, std::tuple<Ins...>> : public EventT<Meta> {
+public:
+  using Param = std::tuple<Ins...>;
+
+  static_assert(!kKeyed || sizeof...(Ins) > 0,
+                "Keyed events take the key as first parameter");
+
+  StickyEventT(const Ins&... ins) : EventT<Meta>(ins...) {
+    this->set_sticky();
+  }
+
+  template <typename... Args>
+  explicit StickyEventT(InPlace, Args&&... args)
+      : EventT<Meta>(InPlace(), std::forward<Args>(args)...) {
+    this->set_sticky();
+  }
+
+  // Keys are told apart by hash.
+  uint64_t StickyKey() const override {
+    return KeyHash(std::integral_constant<bool, kKeyed>());
+  }
+
+private:
+  uint64_t KeyHash(std::false_type) const { return 0; }
+
+  uint64_t KeyHash(std::true_type) const {
+    using Key = std::decay_t<std::tuple_element_t<0, Param>>;
+    return std::hash<Key>()(std::get<0>(this->param()));
+  }
+};
+
+
+template <typename EventType>
+struct IsStickyEvent : std::false_type {};
+
+template <typename Meta, bool kKeyed, typename InTuple>
+struct IsStickyEvent<StickyEventT<Meta, kKeyed, InTuple>> : std::true_type {};
+
+
+// Class RpcEventT ------------------------------------------------------------
+// Event template for requests expecting a reply, defined by
+// EVENT_DEFINE_RPC(name, (ins...), (outs...)) and fired by EventBus::Call or
+// EventBus::CallAsync. The handler handling the event replies by returning
+// the outputs, a single one as is and several as a Reply tuple, or void
+// when there are none. The reply state lives in the event, allocated from
+// the event pool with it. Only the first reply counts, an event deleted
+// without reply fails the call.
+template <typename Meta,
+          typename InTuple = typename Meta::InTuple,
+          typename OutTuple = typename Meta::OutTuple>
+class RpcEventT;
+
+template <typename Meta, typename... Ins, typename... Outs>
+class RpcEventT<Meta, std::tuple<Ins...>, std::tuple<Outs...>>
+    : public EventT<Meta> {
+public:
+  using ThisType = RpcEventT<Meta, std::tuple<Ins...>, std::tuple<Outs...>>;
+  using Param = std::tuple<Ins...>;
+  using Reply = std::tuple<Outs...>;
+  // Called with |replied| false and a default Reply if no handler replied.
+  using ReplyCallback = std::function<void(bool replied, Reply reply)>;
+
+  RpcEventT(const Ins&... ins)
+      : EventT<Meta>(ins...), replied_(false), has_promise_(false),
+        runner_(TaskRunner::THREAD_COUNT) {}
+
+  template <typename... Args>
+  explicit RpcEventT(InPlace, Args&&... args)
+      : EventT<Meta>(InPlace(), std::forward<Args>(args)...),
+        replied_(false), has_promise_(false),
+        runner_(TaskRunner::THREAD_COUNT) {}
+
+  ~RpcEventT() override {
+    if (!replied_.exchange(true))
+      Send(false, Reply());
+  }
+
+  static void* operator new(size_t size) {
+    if (size != sizeof(ThisType))
+      return ::operator new(size);
+    return EventPool<ThisType>::Allocate();
+  }
+
+  static void operator delete(void* block, size_t size) {
+    if (size != sizeof(ThisType))
+      ::operator delete(block);
+    else
+      EventPool<ThisType>::Release(block);
+  }
+
+  // Set by the caller before firing, one or the other.
+  std::future<Reply> GetFuture() {
+    has_promise_ = true;
+    return promise_.get_future();
+  }
+
+  // |callback| is posted to |runner| with the reply.
+  void SetReplyCallback(ReplyCallback callback, TaskRunner::ID runner) {
+    assert(runner < TaskRunner::THREAD_COUNT);
+    callback_ = std::move(callback);
+    runner_ = runner;
+  }
+
+  // Replies to the caller, ignored if a reply was already sent. Can be
+  // called by any handler of the event.
+  void SetReply(Reply reply) const {
+    if (!replied_.exchange(true))
+      Send(true, std::move(reply));
+  }
+
+  template <typename T, typename F>
+  static void Dispatch(const Event* msg, T* obj, F func) {
+    static_cast<const ThisType*>(msg)->DeliverTo(obj, func,
+                                                 msg->IsConsumable());
+  }
+
+  // Calls |method| of |obj| with the parameters as EventT does and replies
+  // with what it returns.
+  template <typename T, typename R, typename... Args>
+  void DeliverTo(T* obj, R (T::*method)(Args...), bool consumable) const {
+    SetReply(Reply(Invoke(obj, method, consumable)));
+  }
+
+  template <typename T, typename... Args>
+  void DeliverTo(T* obj, void (T::*method)(Args...), bool consumable) const {
+    static_assert(sizeof...(Outs) == 0, "The handler must return the reply");
+    Invoke(obj, method, consumable);
+    SetReply(Reply());
+  }
+
+private:
+  template <typename T, typename F>
+  decltype(auto) Invoke(T* obj, F func, bool consumable) const {
+    // The bus is the only owner of a consumable event, it is not really
+    // const.
+    if (consumable) {
+      return DispatchToMethod(obj, func,
+                              std::move(const_cast<Param&>(this->param())));
+    }
+    return DispatchToMethod(obj, func, this->param());
+  }
+
+  void Send(bool replied, Reply reply) const {
+    if (callback_) {
+      ReplyCallback callback = std::move(callback_);
+      TaskRunner::PostTask(
+          runner_,
+          Callback([callback, replied, reply]() { callback(replied, reply); }));
+    } else if (has_promise_ && replied) {
+      promise_.set_value(std::move(reply));
+    }
+    // A promise left unset is broken when the event is deleted.
+  }
+
+  mutable std::atomic<bool> replied_;
+  mutable std::promise<Reply> promise_;
+  bool has_promise_;
+  mutable ReplyCallback callback_;
+  TaskRunner::ID runner_;
+};
+
+
+template <typename Tuple>
+struct FirstParam {};
+
+template <typename T, typename... Ts>
+struct FirstParam<std::tuple<T, Ts...>> {
+  using Type = std::decay_t<T>;
+};
+
+// Type of the key of EventType, its first parameter.
+template <typename EventType>
+using EventKey = typename FirstParam<typename EventType::Param>::Type;
+
+// Hash of the key of |event|, an EventType.
+template <typename EventType>
+uint64_t HashEventKey(const Event* event) {
+  const EventType* this_event = static_cast<const EventType*>(event);
+  return std::hash<EventKey<EventType>>()(std::get<0>(this_event->param()));
+}
+
+
+// Class EventBatchBase -------------------------------------------------------
+class EventBatchBase {
+public:
+  virtual ~EventBatchBase() = default;
+
+  // Number of events in the batch.
+  size_t size() const { return size_; }
+
+protected:
+  size_t size_ = 0;
+
+private:
+  friend class EventBus;
+
+  // Copies the parameters of |event| to the end of the batch, the event
+  // itself goes on to its other subscribers.
+  virtual void Append(const Event* event) = 0;
+  virtual void Clear() = 0;
+
+};
+
+
+// Class EventBatch -----------------------------------------------------------
+// Pending EventType events handed at once to the subscribers of
+// EventBus::SubscribeBatch, stored structure of arrays: column N holds
+// parameter N of every event, contiguous and in firing order, ready for
+// vectorized loops.
+template <typename EventType,
+          typename Param = typename EventType::Param>
+class EventBatch;
+
+template <typename EventType, typename... Ins>
+class EventBatch<EventType, std::tuple<Ins...>> : public EventBatchBase {
+public:
+  using Param = std::tuple<Ins...>;
+  template <size_t N>
+  using Column = std::vector<std::decay_t<std::tuple_element_t<N, Param>>>;
+
+  template <size_t N>
+  const Column<N>& column() const { return std::get<N>(columns_); }
+
+private:
+  void Append(const Event* event) override {
+    AppendImpl(static_cast<const EventType*>(event)->param(),
+               std::index_sequence_for<Ins...>());
+    ++size_;
+  }
+
+  void Clear() override {
+    ClearImpl(std::index_sequence_for<Ins...>());
+    size_ = 0;
+  }
+
+  template <size_t... Ns>
+  void AppendImpl(const Param& param, std::index_sequence<Ns...>) {
+    int expand[] = {
+        0, (std::get<Ns>(columns_).push_back(std::get<Ns>(param)), 0)... };
+    (void)expand;
+  }
+
+  // Keeps the capacity of the columns.
+  template <size_t... Ns>
+  void ClearImpl(std::index_sequence<Ns...>) {
+    int expand[] = { 0, (std::get<Ns>(columns_).clear(), 0)... };
+    (void)expand;
+  }
+
+  std::tuple<std::vector<std::decay_t<Ins>>...> columns_;
+
+};
+
+
+// Class CancelToken ----------------------------------------------------------
+// Returned by EventBus::FireCancelable and BroadcastCancelable, cancels the
+// event it was returned for. It holds a flag shared with the event, not the
+// event, so it stays safe to use once the event is deleted and its block
+// reused by the event pool.
+class CancelToken {
+public:
+  CancelToken() = default;
+
+  // The runners which didn't get to the event yet drop it without calling
+  // any handler or observer. Can be called from any thread.
+  void Cancel() const {
+    if (flag_)
+      flag_->store(true, std::memory_order_relaxed);
+  }
+
+  bool IsCanceled() const {
+    return flag_ && flag_->load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class EventBus;
+
+  explicit CancelToken(std::shared_ptr<std::atomic<bool>> flag)
+      : flag_(std::move(flag)) {}
+
+  std::shared_ptr<std::atomic<bool>> flag_;
+
+};
+
+
+// Returned by EventBus::Subscribe, identifies one subscription. 64 bits, so
+// a handle is not reused before its entry is reused 2^39 times.
+using SubscriptionHandle = int64_t;
+const SubscriptionHandle kInvalidSubscription = -1;
+
+
+// Options of EventBus::SubscribeIsolated.
+struct IsolationOptions {
+  // What a full queue does with an incoming event.
+  enum Overflow {
+    // Drops the oldest queued event.
+    DROP_OLDEST,
+    // Drops the incoming event.
+    DROP_NEWEST,
+    // The incoming event replaces the queued one with the same key, its
+    // first parameter, in place, so the queue holds the latest event of
+    // each key. An event of a new key drops the oldest one when full.
+    COALESCE,
+  };
+
+  // Maximum number of queued events.
+  size_t capacity = 256;
+  Overflow overflow = DROP_OLDEST;
+  // Runner the handler runs on. By default the subscriptions are spread
+  // over the dispatch runners.
+  TaskRunner::ID runner = TaskRunner::THREAD_COUNT;
+};
+
+
+// Class SubscriberQueue ------------------------------------------------------
+// Bounded queue of an isolated subscriber, a ring of the parameters of the
+// queued events. Filled by the threads firing the events and drained by the
+// runner of the subscriber, see EventBus::SubscribeIsolated.
+class SubscriberQueue {
+public:
+  virtual ~SubscriberQueue() = default;
+
+protected:
+  explicit SubscriberQueue(size_t capacity);
+
+  // At least 1.
+  size_t capacity() const { return capacity_; }
+
+  // Destroys the queued parameters.
+  void Clear();
+
+private:
+  friend class EventBus;
+
+  struct Entry {
+    // Hash of the key with the COALESCE policy, 0 otherwise.
+    uint64_t key;
+    int64_t queued_ns;
+    // Cancellation state of the queued event, see Event.
+    std::shared_ptr<std::atomic<bool>> cancel_flag;
+    uint32_t cancel_epoch;
+  };
+
+  // Copies the parameters of |event| to entry |index|.
+  virtual void Store(size_t index, const Event* event) = 0;
+  virtual void Destroy(size_t index) = 0;
+  // Moves the parameters of entry |index| out for DeliverTaken.
+  virtual void Take(size_t index) = 0;
+  // Calls the handler with the parameters taken last.
+  virtual void DeliverTaken() = 0;
+  virtual uint64_t KeyOf(const Event* event) const = 0;
+  virtual bool SameKey(size_t index, const Event* event) = 0;
+  // Hash of the key of entry |index|, as HashEventKey.
+  virtual uint64_t CancelKeyOf(size_t index) = 0;
+
+  const size_t capacity_;
+  IsolationOptions::Overflow overflow_ = IsolationOptions::DROP_OLDEST;
+  TaskRunner::ID runner_ = TaskRunner::EVENT;
+  int slot_ = kUnknownEventSlot;
+  SubscriptionHandle handle_ = kInvalidSubscription;
+
+  // Guards the members below.
+  std::mutex lock_;
+  // Signaled when the handler returns once the queue is closed.
+  std::condition_variable idle_;
+  std::vector<Entry> entries_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  // A drain task is posted.
+  bool scheduled_ = false;
+  bool delivering_ = false;
+  // Unsubscribed.
+  bool closed_ = false;
+
+  // Lag counters.
+  size_t max_queued_ = 0;
+  uint64_t delivered_ = 0;
+  uint64_t dropped_ = 0;
+  uint64_t coalesced_ = 0;
+  int64_t lag_ns_ = 0;
+  int64_t max_lag_ns_ = 0;
+
+};
+
+template <typename EventType, typename T, typename Method>
+class SubscriberQueueT : public SubscriberQueue {
+public:
+  using Param = typename EventType::Param;
+
+  SubscriberQueueT(size_t capacity, T* obj, Method method)
+      : SubscriberQueue(capacity),
+        obj_(obj),
+        method_(method),
+        values_(new Storage[this->capacity()]) {}
+
+  ~SubscriberQueueT() override { Clear(); }
+
+private:
+  using Storage = std::aligned_storage_t<sizeof(Param), alignof(Param)>;
+  using HasKey =
+      std::integral_constant<bool, (std::tuple_size<Param>::value > 0)>;
+
+  Param* value(size_t index) {
+    return reinterpret_cast<Param*>(&values_[index]);
+  }
+
+  void Store(size_t index, const Event* event) override {
+    // Other subscribers get the event too, it is copied.
+    new (value(index)) Param(static_cast<const EventType*>(event)->param());
+  }
+
+  void Destroy(size_t index) override { value(index)->~Param(); }
+
+  void Take(size_t index) override {
+    new (&taken_) Param(std::move(*value(index)));
+    value(index)->~Param();
+  }
+
+  void DeliverTaken() override {
+    Param* taken = reinterpret_cast<Param*>(&taken_);
+    DispatchToMethod(obj_, method_, std::move(*taken));
+    taken->~Param();
+  }
+
+  uint64_t KeyOf(const Event* event) const override {
+    return HashKey(static_cast<const EventType*>(event)->param(), HasKey());
+  }
+
+  bool SameKey(size_t index, const Event* event) override {
+    return KeyEquals(*value(index),
+                     static_cast<const EventType*>(event)->param(), HasKey());
+  }
+
+  uint64_t CancelKeyOf(size_t index) override {
+    return HashKey(*value(index), HasKey());
+  }
+
+  static uint64_t HashKey(const Param& param, std::true_type) {
+    return std::hash<std::decay_t<std::tuple_element_t<0, Param>>>()(
+        std::get<0>(param));
+  }
+  static uint64_t HashKey(const Param& param, std::false_type) { return 0; }
+
+  static bool KeyEquals(const Param& a, const Param& b, std::true_type) {
+    return std::get<0>(a) == std::get<0>(b);
+  }
+  static bool KeyEquals(const Param& a, const Param& b, std::false_type) {
+    return true;
+  }
+
+  T* obj_;
+  Method method_;
+  std::unique_ptr<Storage[]> values_;
+  // Parameters being delivered, only touched on the subscriber's runner.
+  Storage taken_;
+
+};
+
+
+// Dispatch counters of an event type, see EventBus::GetMetrics().
+struct EventMetrics {
+  int slot = kUnknownEventSlot;
+  // Name given by the EVENT_DEFINE macros, null for other events.
+  const char* name = nullptr;
+  // An event merged into a pending coalesced one is fired but not
+  // dispatched, a routed or broadcast one is dispatched once per runner.
+  uint64_t fired = 0;
+  uint64_t dispatched = 0;
+  // Dispatches no handler handled, broadcasts aside.
+  uint64_t unhandled = 0;
+  // Dispatches dropped as the event was canceled.
+  uint64_t canceled = 0;
+  // Total and longest time from firing to dispatch.
+  int64_t queue_delay_ns = 0;
+  int64_t max_queue_delay_ns = 0;
+  // Total time spent in the handlers, Register'ed observers included.
+  int64_t handler_ns = 0;
+};
+
+// Handler time of one subscription.
+struct SubscriberMetrics {
+  SubscriptionHandle handle = kInvalidSubscription;
+  int slot = kUnknownEventSlot;
+  uint64_t calls = 0;
+  int64_t handler_ns = 0;
+};
+
+// Queue of a subscriber of EventBus::SubscribeIsolated. Always counted,
+// whether metrics are on or not.
+struct IsolatedMetrics {
+  SubscriptionHandle handle = kInvalidSubscription;
+  int slot = kUnknownEventSlot;
+  TaskRunner::ID runner = TaskRunner::EVENT;
+  size_t capacity = 0;
+  // Events in the queue now, and at most.
+  size_t queued = 0;
+  size_t max_queued = 0;
+  uint64_t delivered = 0;
+  // Events dropped by a full queue, and replaced by a later one of their
+  // key.
+  uint64_t dropped = 0;
+  uint64_t coalesced = 0;
+  // Total and longest time from queueing to the handler call.
+  int64_t lag_ns = 0;
+  int64_t max_lag_ns = 0;
+};
+
+// Snapshot of the dispatch metrics.
+struct EventBusMetrics {
+  // Event types fired or dispatched while metrics were on.
+  std::vector<EventMetrics> events;
+  // Live subscriptions, except the isolated ones.
+  std::vector<SubscriberMetrics> subscribers;
+  // Live isolated subscriptions.
+  std::vector<IsolatedMetrics> isolated;
+};
+
+
 // Class EventBus -------------------------------------------------------------
 class EventBus {
 public:
+  // Maximum number of distinct event types that can have subscribers.
+  // Subscribing to a type registered past them returns kInvalidSubscription.
+  static const int kMaxEventSlots = 1024;
+
   static void Initialize();
   static void Uninitialize();
+
+  // Posts |event| for dispatch. A coalesced event is merged into the pending
+  // one of its type and key if there is one, see CoalescedEventT. A sticky
+  // one replaces the event kept for its type and key, see StickyEventT.
   static void FireEvent(const Event* event);
+
+  // Maximum nesting of FireEventNow dispatches.
+  static const int kMaxDispatchDepth = 8;
+
+  // Dispatches |event| synchronously when called on EVENT, before returning,
+  // and returns true. Handlers may fire further events inline up to
+  // kMaxDispatchDepth levels deep, unsubscribing while nested is safe as
+  // compaction waits for the outermost dispatch. The event is queued by
+  // FireEvent instead, and false returned, when called on another runner,
+  // when the nesting limit is reached, when runners other than EVENT
+  // subscribe it, when it is coalesced, which keeps it ordered after the
+  // pending one, or when it is sticky. Batch subscribers get it in their
+  // next batch either way.
+  static bool FireEventNow(const Event* event);
+
+  // Constructs an EventType from |args| in its pool and fires it.
+  template <typename EventType, typename... Args>
+  static void Emit(Args&&... args) {
+    FireEvent(new EventType(InPlace(), std::forward<Args>(args)...));
+  }
+
+  // True if EventType has subscribers of any kind on any runner, or taps,
+  // or if any observer is Register'ed, as observers get every type. A
+  // single load per kind, cheap enough to guard building an event.
+  template <typename EventType>
+  static bool HasSubscribers() {
+    return HasSubscribers(EventType::Slot());
+  }
+
+  static bool HasSubscribers(int slot);
+
+  // Fires the event returned by |factory|, a new EventType, if EventType
+  // has subscribers and returns true. Otherwise |factory| is not called and
+  // false returned, e.g.
+  //   EventBus::FireEventLazy<Snapshot>(
+  //       [this]() { return new Snapshot(FormatSnapshot()); });
+  // An event fired while its first subscriber subscribes may be skipped,
+  // as if fired just before. Sticky events are always built, for the
+  // subscribers to come.
+  template <typename EventType, typename Factory>
+  static bool FireEventLazy(Factory&& factory) {
+    if (!IsStickyEvent<EventType>::value && !HasSubscribers<EventType>())
+      return false;
+    const EventType* event = factory();
+    FireEvent(event);
+    return true;
+  }
+
+  // Fires an EventType defined with EVENT_DEFINE_RPC, constructed from
+  // |args|, and returns the future reply of its handler, e.g.
+  //   std::future<Lookup::Reply> reply = EventBus::Call<Lookup>(key);
+  // The future is broken if no handler replies. Waiting for it on the
+  // runner of the handler deadlocks.
+  template <typename EventType, typename... Args>
+  static std::future<typename EventType::Reply> Call(Args&&... args) {
+    EventType* event = new EventType(InPlace(), std::forward<Args>(args)...);
+    std::future<typename EventType::Reply> reply = event->GetFuture();
+    FireEvent(event);
+    return reply;
+  }
+
+  // Same as Call, but |reply| is posted to |reply_runner| instead. Threads
+  // which aren't runners, such as the main thread, pick the runner getting
+  // their replies this way.
+  template <typename EventType, typename... Args>
+  static void CallAsync(TaskRunner::ID reply_runner,
+                        typename EventType::ReplyCallback reply,
+                        Args&&... args) {
+    EventType* event = new EventType(InPlace(), std::forward<Args>(args)...);
+    event->SetReplyCallback(std::move(reply), reply_runner);
+    FireEvent(event);
+  }
+
+  // Same as above, with the reply posted to the calling runner. Must be
+  // called on a runner.
+  template <typename EventType, typename... Args>
+  static void CallAsync(typename EventType::ReplyCallback reply,
+                        Args&&... args) {
+    assert(TaskRunner::CurrentID() < TaskRunner::THREAD_COUNT);
+    CallAsync<EventType>(TaskRunner::CurrentID(), std::move(reply),
+                         std::forward<Args>(args)...);
+  }
+
+  // Number of runners dispatching sharded events.
+  static const int kShardCount = TaskRunner::kDispatchShardCount;
+
+  // Fires |event| in sharded mode. Per key ordered subscribers are run on
+  // the dispatch runner the key of the event hashes to, so events of a key
+  // are handled in firing order and different keys in parallel. Global order
+  // subscribers get it on their runner as with FireEvent, in firing order
+  // across all keys. Register'ed observers are not offered sharded events.
+  template <typename EventType>
+  static void FireSharded(const EventType* event) {
+    FireSharded(event, HashEventKey<EventType>(event));
+  }
+
+  static void FireSharded(const Event* event, uint64_t key_hash);
+
+  // Delivers |event| to every subscriber on every runner and to every
+  // Register'ed observer, whatever they return. The single instance is
+  // shared read only by all runners and deleted after the last one is done.
+  static void Broadcast(const Event* event);
+
+  // Fires |event| as FireEvent does and returns a token canceling it until
+  // it is dispatched. Handing the token to the handlers lets the first
+  // runner handling a routed event stop the others. A pending coalesced
+  // event is canceled by the token of the last event merged into it.
+  // Isolated subscribers drop their queued copy too. Taps get the event
+  // when fired, before it can be canceled, and the copies batch subscribers
+  // got then aren't canceled.
+  static CancelToken FireCancelable(const Event* event);
+
+  // Same for Broadcast.
+  static CancelToken BroadcastCancelable(const Event* event);
+
+  // Cancels the events with |event_id| fired so far and not dispatched yet,
+  // those fired afterwards are dispatched as usual. The events are dropped
+  // where they are queued, canceling costs a counter increment and dispatch
+  // one more load per event.
+  static void CancelPending(int event_id);
+
+  // Same for the pending EventType events whose key, their first parameter,
+  // equals |key|, e.g.
+  //   EventBus::CancelPending<OrderUpdated>(order_id);
+  // Keys are compared by hash. A canceled key is looked up without locking
+  // by the dispatch of the type until every runner has run the tasks queued
+  // when it was canceled, it is forgotten then.
+  template <typename EventType>
+  static void CancelPending(const EventKey<EventType>& key) {
+    CancelPendingKey(EventType::Slot(), &HashEventKey<EventType>,
+                     std::hash<EventKey<EventType>>()(key));
+  }
+
+  // Observers are added and removed immediately and from any runner.
+  // Dispatch reads a published snapshot of them without locking, snapshots
+  // replaced since are reclaimed once no dispatch can still read them. Once
+  // Unregister returns the observer is not called anymore, so off EVENT it
+  // waits for a dispatch in progress to finish.
   static void Register(EventObserver* observer);
   static void Unregister(EventObserver* observer);
 
+  // Subscribes |observer| to the event with |event_id| only. Subscribers are
+  // kept in a contiguous array per event ID and are offered the event before
+  // the observers added by Register, the first one returning true handles
+  // it.
+  //
+  // A subscription is affine to the runner it is made on: events are posted
+  // straight to every runner having subscribers for them, with one post per
+  // runner, and handled there. The first subscriber returning true wins on
+  // its runner only, so an event routed to several runners is handled once
+  // per runner, as if broadcast across them. Register'ed observers count as
+  // part of EVENT: they are offered the event when no subscriber of EVENT
+  // handled it, whatever the subscribers on other runners returned.
+  // Unsubscribe must be called on the runner the subscription was made on,
+  // unsubscribing a handle again is a no-op even once a new subscription
+  // reuses its entry.
+  static SubscriptionHandle Subscribe(EventObserver* observer, int event_id);
+  static void Unsubscribe(SubscriptionHandle handle);
+
+  // Subscribes |method| of |obj| to EventType directly, e.g.
+  //   EventBus::Subscribe<TestEvent>(listener, &Listener::Test);
+  // Dispatch indexes the handler by the event's slot and calls |method| with
+  // the event parameters, no GetID() call or event map switch is involved.
+  // When no other subscriber or observer can get the event after it, and
+  // the event is not broadcast, its parameters are moved into by value
+  // parameters of |method|. Affinity is the same as above.
+  template <typename EventType, typename T, typename R, typename... Args>
+  static SubscriptionHandle Subscribe(T* obj, R (T::*method)(Args...)) {
+    return AddHandler(
+        { EventType::Slot(), false, 0 }, nullptr,
+        [obj, method](const Event* event, bool consumable) {
+          static_cast<const EventType*>(event)->DeliverTo(obj, method,
+                                                          consumable);
+          return true;
+        });
+  }
+
+  // Subscribes |method| of |obj| to the EventType events whose key, their
+  // first parameter, equals |key|, e.g.
+  //   EventBus::Subscribe<EntityChanged>(entity_id, listener,
+  //                                      &Listener::OnChanged);
+  // Keyed subscribers are indexed by event slot and key hash, so dispatch
+  // only visits the ones for the key of the event, before the subscribers
+  // without key. Otherwise they behave as above.
+  template <typename EventType, typename T, typename R, typename... Args>
+  static SubscriptionHandle Subscribe(const EventKey<EventType>& key,
+                                      T* obj,
+                                      R (T::*method)(Args...)) {
+    return AddHandler(
+        { EventType::Slot(), true, std::hash<EventKey<EventType>>()(key) },
+        &HashEventKey<EventType>,
+        [key, obj, method](const Event* event, bool consumable) {
+          const EventType* this_event = static_cast<const EventType*>(event);
+          // Keys with the same hash share a list.
+          if (!(std::get<0>(this_event->param()) == key))
+            return false;
+          this_event->DeliverTo(obj, method, consumable);
+          return true;
+        });
+  }
+
+  // Ordering a subscriber needs.
+  enum Ordering {
+    // Events are handled one at a time on the runner the subscription is
+    // made on, same as Subscribe above.
+    GLOBAL_ORDER,
+    // Events of a key are handled in order, events of different keys
+    // concurrently on the dispatch runners, started by the first such
+    // subscription, so the handler must be thread safe. Only sharded events
+    // are delivered. Unsubscribe can be called from any runner and waits for
+    // running handlers, except when called from a handler.
+    PER_KEY_ORDER,
+  };
+
+  template <typename EventType, typename T, typename R, typename... Args>
+  static SubscriptionHandle Subscribe(Ordering ordering,
+                                      T* obj,
+                                      R (T::*method)(Args...)) {
+    if (ordering == GLOBAL_ORDER)
+      return Subscribe<EventType>(obj, method);
+    return AddShardedHandler(
+        EventType::Slot(),
+        [obj, method](const Event* event, bool consumable) {
+          static_cast<const EventType*>(event)->DeliverTo(obj, method,
+                                                          consumable);
+          return true;
+        });
+  }
+
+  using EventHandler = std::function<void(const Event*)>;
+  static SubscriptionHandle SubscribeHandler(int slot, EventHandler handler);
+
+  // Calls |tap| with every event of |event_id| as it is fired, on the firing
+  // thread and before any subscriber or observer gets it, so whatever they
+  // return and however the event is fired. Coalesced events are tapped
+  // before being merged, batched ones before joining their batch. For
+  // components seeing all the events of a type, such as EventTransport and
+  // EventJournal. |tap| must be thread safe, must not modify the event and
+  // must not fire events. Unsubscribe removes it from any thread, except
+  // from a tap, and waits for running taps.
+  using TapHandler = std::function<void(const Event* event)>;
+  static SubscriptionHandle AddTap(int event_id, TapHandler tap);
+
+  // Where the batches of an event type are dispatched among other events.
+  enum BatchOrdering {
+    // Where the first event of the batch would have been. Events fired
+    // until then join the batch, overtaking the events of other types fired
+    // in between. One task is posted per batch.
+    BATCH_AT_FIRST,
+    // Where the last event of the batch would have been, so no event of the
+    // batch is handled before events of other types fired ahead of it. One
+    // task is still posted per event.
+    BATCH_AT_LAST,
+  };
+
+  // A BATCH_AT_LAST batch holding this many events, or whose first event
+  // was fired this long ago, is handled where the next of its events would
+  // have been, so a steady stream can't hold it back forever. Its later
+  // events then overtake the events of other types fired before them.
+  static const size_t kMaxBatchEvents = 4096;
+  static const int64_t kMaxBatchDelayNs = 10 * 1000 * 1000;
+
+  // Subscribes |method| of |obj| to batches of EventType, e.g.
+  //   void Listener::OnTicks(const EventBatch<PriceTick>& ticks);
+  //   EventBus::SubscribeBatch<PriceTick>(listener, &Listener::OnTicks);
+  // EventType events, however fired, have their parameters copied into the
+  // pending batch of the type, which is handed to every batch subscriber in
+  // a single call. The events are still dispatched to the other subscribers
+  // and observers as usual. Kept sticky events are not replayed to batch
+  // subscribers. Batch subscribers of a type must subscribe on the same
+  // runner, where the batches are handled, with the same ordering.
+  // Unsubscribe must be called there too.
+  template <typename EventType, typename T>
+  static SubscriptionHandle SubscribeBatch(
+      T* obj,
+      void (T::*method)(const EventBatch<EventType>&),
+      BatchOrdering ordering = BATCH_AT_FIRST) {
+    return AddBatchHandler(
+        EventType::Slot(), &NewBatch<EventType>, ordering,
+        [obj, method](const EventBatchBase& batch) {
+          (obj->*method)(static_cast<const EventBatch<EventType>&>(batch));
+        });
+  }
+
+  // Subscribes |method| of |obj| to EventType in isolation, e.g.
+  //   IsolationOptions options;
+  //   options.overflow = IsolationOptions::COALESCE;
+  //   EventBus::SubscribeIsolated<Quote>(chart, &Chart::OnQuote, options);
+  // The parameters are copied into a bounded queue of the subscriber by a
+  // tap, see AddTap, so it gets every event of the type however it is fired
+  // and whatever the other subscribers return. The handler runs on
+  // |options.runner|. A slow handler thus only delays its own events, and
+  // once its queue is full |options.overflow| tells which ones it loses.
+  // The lag of the queue is reported by GetMetrics. Subscribe and
+  // Unsubscribe can be called from any thread except a tap. Unsubscribe
+  // waits for a running handler, except when called from it.
+  template <typename EventType, typename T, typename R, typename... Args>
+  static SubscriptionHandle SubscribeIsolated(
+      T* obj,
+      R (T::*method)(Args...),
+      const IsolationOptions& options = IsolationOptions()) {
+    std::shared_ptr<SubscriberQueue> queue(
+        new SubscriberQueueT<EventType, T, R (T::*)(Args...)>(
+            options.capacity, obj, method));
+    return AddIsolatedHandler(EventType::Slot(), std::move(queue), options);
+  }
+
+  // Forgets the sticky events kept for |event_id|.
+  static void ClearSticky(int event_id);
+
+  // Turns the dispatch metrics on or off, off by default as they time every
+  // handler call. Counters are kept per thread without locking and only
+  // summed by GetMetrics, which can be called from any thread.
+  static void EnableMetrics(bool enabled);
+  static EventBusMetrics GetMetrics();
+
   void OnEvent(const Event* event);
+  // Same for a sticky event, which the bus keeps.
+  void OnStickyEvent(std::shared_ptr<const Event> event);
   void AddObserver(EventObserver* observer);
   void RemoveObserver(EventObserver* observer);
   bool HasObserver(const EventObserver* observer) const;
 
 private:
-  EventBus() = default;
+  // Handler of a subscriber, returns true if it handled the event. It may
+  // move the parameters out of a |consumable| event, see
+  // DispatchToSubscribers.
+  using Handler = std::function<bool(const Event* event, bool consumable)>;
+  using KeyHashFunction = uint64_t (*)(const Event* event);
+
+  // Calls and handler time of a subscriber. Only the runner of a global
+  // order subscriber writes them, every shard may write those of a per key
+  // ordered one.
+  struct SubscriberCounters {
+    SubscriberCounters(SubscriptionHandle handle, int slot)
+        : handle(handle), slot(slot), calls(0), handler_ns(0) {}
+
+    SubscriptionHandle handle;
+    int slot;
+    std::atomic<uint64_t> calls;
+    std::atomic<int64_t> handler_ns;
+  };
+
+  // Either |observer| or |handler| is set. The handler is boxed so it stays
+  // in place while running even if the array grows.
+  struct Subscriber {
+    EventObserver* observer;
+    std::unique_ptr<Handler> handler;
+    SubscriptionHandle handle;
+    bool removed;
+    std::shared_ptr<SubscriberCounters> counters;
+    // Sequence of the last sticky event replayed to it, 0 if none.
+    uint32_t replayed;
+  };
+
+  struct SubscriberList {
+    std::vector<Subscriber> subscribers;
+    // Number of unsubscribed entries waiting for compaction.
+    size_t removed = 0;
+  };
+
+  // Identifies a subscriber list, keyed ones by the hash of their key.
+  struct ListKey {
+    int slot;
+    bool keyed;
+    uint64_t key;
+  };
+
+  // Keyed subscribers of an event slot.
+  struct KeyedIndex {
+    KeyHashFunction hash = nullptr;
+    std::unordered_map<uint64_t, SubscriberList> lists;
+  };
+
+  // Where the subscriber of a handle is.
+  struct HandleEntry {
+    ListKey list;
+    size_t index;
+    // Bumped each time the entry is freed, wraps at kHandleGenerationBits.
+    uint64_t generation = 0;
+  };
+
+  // Subscriptions of one runner, only touched on that runner.
+  struct Registry {
+    // Indexed by event slot. Deques, so a subscription to a new slot made by
+    // a handler doesn't move the list being dispatched.
+    std::deque<SubscriberList> subscribers;
+    std::deque<KeyedIndex> keyed;
+    // Live subscribers, keyed or not, per event slot.
+    std::vector<size_t> counts;
+    // Indexed by HandleLocal().
+    std::vector<HandleEntry> handles;
+    std::vector<int> free_handles;
+    // Lists with removed subscribers. Compaction is deferred to the end of
+    // dispatch so removals during dispatch stay O(1) and safe.
+    std::vector<ListKey> dirty_lists;
+    // Number of dispatches in progress, more than one when nested by
+    // FireEventNow.
+    int dispatch_depth = 0;
+  };
+
+  using BatchHandler = std::function<void(const EventBatchBase& batch)>;
+  using BatchFactory = EventBatchBase* (*)();
+
+  struct BatchSubscriber {
+    BatchHandler handler;
+    SubscriptionHandle handle;
+    bool removed;
+  };
+
+  // Pending batch of an event type with batch subscribers. Never deleted
+  // before the bus, the firing threads may still read it.
+  struct BatchQueue {
+    std::mutex lock;
+    // Guarded by |lock|.
+    std::unique_ptr<EventBatchBase> pending;
+    // Sequence of the last event appended, guarded by |lock|.
+    uint64_t appended = 0;
+    // When the first pending event was appended under BATCH_AT_LAST,
+    // guarded by |lock|.
+    int64_t first_ns = 0;
+    // False once the last subscriber is gone.
+    std::atomic<bool> active{false};
+    BatchOrdering ordering = BATCH_AT_FIRST;
+    TaskRunner::ID runner = TaskRunner::EVENT;
+
+    // Only touched on |runner|.
+    std::unique_ptr<EventBatchBase> dispatching;
+    std::vector<BatchSubscriber> subscribers;
+    bool in_dispatch = false;
+  };
+
+  // Identifies an event type and key, as the pending coalesced event of a
+  // key or its cancellation.
+  struct PendingKey {
+    int slot;
+    uint64_t key;
+
+    bool operator==(const PendingKey& other) const {
+      return slot == other.slot && key == other.key;
+    }
+  };
 
-  void Compact();
+  struct PendingKeyHash {
+    size_t operator()(const PendingKey& key) const {
+      return static_cast<size_t>(key.key * 31 + key.slot);
+    }
+  };
+
+  EventBus();
+  ~EventBus();
+
+  static int SlotOf(const Event* event);
+  static uint32_t RoutesOf(int slot);
+  // EVENT's bit while there are Register'ed observers, added to the routes
+  // of first wins events posted to other runners so the observers still
+  // get them.
+  static uint32_t ObserverRoute();
+
+  // Posts |event| to EVENT, or to the runners subscribing it.
+  static void PostEvent(const Event* event);
+
+  template <typename EventType>
+  static EventBatchBase* NewBatch() {
+    return new EventBatch<EventType>;
+  }
+
+  static SubscriptionHandle AddBatchHandler(int slot,
+                                            BatchFactory factory,
+                                            BatchOrdering ordering,
+                                            BatchHandler handler);
+  void RemoveBatchSubscriber(SubscriptionHandle handle);
+  // Returns null if no batch subscriber is live for |slot|.
+  BatchQueue* ActiveBatch(int slot) const;
+  // Appends the parameters of |event| to the pending batch of its type if
+  // it has one.
+  void FireBatched(const Event* event);
+  // Runs on the runner of the batch subscribers, dispatches the pending
+  // batch. With BATCH_AT_LAST only the task of the last event does.
+  void OnBatch(int slot, uint64_t sequence);
+
+  void FireCoalesced(Event* event);
+
+  // Keeps |event| for the subscribers to come and posts it.
+  void FireSticky(const Event* event);
+  // Runs on |runner|, hands the kept events of its type to the new
+  // subscriber |handle|.
+  void ReplaySticky(TaskRunner::ID runner, SubscriptionHandle handle);
+  // Runs on EVENT, takes the pending event out and dispatches it. Events
+  // fired from then on start a new pending one.
+  void OnCoalescedEvent(int slot, uint64_t key);
+
+  // Posts |event| once to every runner in |routes|.
+  static void PostToRunners(uint32_t routes,
+                            const std::shared_ptr<const Event>& event,
+                            bool broadcast);
+
+  void OnRoutedEvent(TaskRunner::ID runner,
+                     std::shared_ptr<const Event> event,
+                     bool broadcast);
+  // Runs on dispatch runner |runner|.
+  void OnShardedEvent(TaskRunner::ID runner,
+                      std::shared_ptr<const Event> event);
+
+  // Dispatches |event| on EVENT, to the subscribers there and then to the
+  // Register'ed observers. |owned| if no one else reads the event.
+  void DispatchOnEvent(const Event* event, bool owned);
+
+  // Without |broadcast| dispatch stops at the first handler, returns true if
+  // the event has been handled. If the bus |owned| the event alone, the last
+  // consumer which can get it may move the parameters out: the last live
+  // subscriber of the last list, unless |observers_follow|, or the last
+  // observer. Earlier ones may return false and pass the event on, so they
+  // never do.
+  bool DispatchToSubscribers(Registry* registry,
+                             const Event* event,
+                             bool broadcast,
+                             bool owned,
+                             bool observers_follow);
+  bool DispatchToList(SubscriberList* list,
+                      const Event* event,
+                      bool broadcast,
+                      bool last_consumes);
+  bool DispatchToObservers(const Event* event, bool broadcast, bool owned);
+
+  bool metrics_enabled() const {
+    return metrics_enabled_.load(std::memory_order_relaxed);
+  }
+  // Stamps |event| with the cancellation epoch of its slot, and with the
+  // time when metrics are on, and counts it as fired.
+  static void StampFired(const Event* event);
+  // Counts the dispatch of |event| which started at |start_ns|.
+  static void CountDispatch(const Event* event,
+                            int64_t start_ns,
+                            bool handled,
+                            bool broadcast);
+  // Adds the counters of a new subscription.
+  std::shared_ptr<SubscriberCounters> AddCounters(SubscriptionHandle handle,
+                                                  int slot);
+  void RemoveCounters(SubscriptionHandle handle);
+
+  static void CancelPendingKey(int slot, KeyHashFunction hash, uint64_t key);
+  // Attaches the flag of a new token to |event|, before it is fired.
+  static CancelToken MakeCancelable(const Event* event);
+
+  // Cancellation of a key waiting for the runners to pass the events
+  // queued before it.
+  struct KeyCancellation {
+    int slot;
+    uint64_t key;
+    uint32_t epoch;
+    // Runners which haven't run their marker task yet.
+    std::atomic<int> markers;
+  };
+
+  // Runs on each runner, the last one forgets the key.
+  static void PassCancelMarker(std::shared_ptr<KeyCancellation> cancellation);
+  void ForgetCanceledKey(const KeyCancellation& cancellation);
+
+  static SubscriptionHandle AddIsolatedHandler(
+      int slot,
+      std::shared_ptr<SubscriberQueue> queue,
+      const IsolationOptions& options);
+  void RemoveIsolatedSubscriber(SubscriptionHandle handle);
+  // Runs on the firing thread as a tap, queues |event| for |queue|.
+  static void QueueIsolated(const std::shared_ptr<SubscriberQueue>& queue,
+                            const Event* event);
+  // Runs on the subscriber's runner, hands the queued events to it.
+  static void DrainIsolated(std::shared_ptr<SubscriberQueue> queue);
+  // Returns true, and counts it, if |event| has been canceled since fired.
+  // Runs on |runner|, dispatching it.
+  bool DropCanceled(TaskRunner::ID runner, const Event* event);
+  // True if an event of |slot| fired at cancellation |epoch| was canceled
+  // since by CancelPending. |key_hash| returns the hash of its key, it is
+  // only called while keys of the slot are canceled. Runs on |runner|.
+  template <typename KeyHash>
+  bool CanceledSince(TaskRunner::ID runner,
+                     int slot,
+                     uint32_t epoch,
+                     KeyHash key_hash);
+
+  // Subscribes |handler| to |list| on the current runner. |hash| hashes the
+  // key of the events of a keyed list.
+  static SubscriptionHandle AddHandler(const ListKey& list,
+                                       KeyHashFunction hash,
+                                       Handler handler);
+
+  SubscriptionHandle AddSubscriber(TaskRunner::ID runner,
+                                   const ListKey& list,
+                                   KeyHashFunction hash,
+                                   Subscriber subscriber);
+  void RemoveSubscriber(SubscriptionHandle handle);
+  // Returns null if |handle| is unsubscribed.
+  static Subscriber* FindSubscriber(Registry* registry,
+                                    SubscriptionHandle handle);
+  // Subscriber handles hold the runner in the low bits, then the generation
+  // of their handle entry, then the entry index. A stale handle matches the
+  // subscriber which reuses its entry only once the generation wraps.
+  static SubscriptionHandle MakeHandle(TaskRunner::ID runner,
+                                       size_t local,
+                                       uint64_t generation);
+  static TaskRunner::ID HandleRunner(SubscriptionHandle handle);
+  static size_t HandleLocal(SubscriptionHandle handle);
+  static uint64_t HandleGeneration(SubscriptionHandle handle);
+  // Returns null if there is no such list.
+  static SubscriberList* FindList(Registry* registry, const ListKey& list);
+
+  static SubscriptionHandle AddShardedHandler(int slot, Handler handler);
+  void RemoveShardedSubscriber(SubscriptionHandle handle);
+
+  // Same as AddTap, for the event type of |slot|.
+  static SubscriptionHandle AddSlotTap(int slot, TapHandler tap);
+  // Calls the taps of the type of |event|, see AddTap.
+  static void RunTaps(const Event* event);
+  void RemoveTap(SubscriptionHandle handle);
+
+  // Compacts the subscribers of |registry| once the outermost dispatch is
+  // over.
+  void EndDispatch(Registry* registry);
+  void CompactSubscribers(Registry* registry);
+
+  // Register'ed observers. Never changed once published, except that the
+  // entry of an unregistered observer is cleared so dispatches still reading
+  // the snapshot skip it.
+  struct ObserverSnapshot {
+    explicit ObserverSnapshot(size_t size)
+        : size(size), observers(new std::atomic<EventObserver*>[size]) {}
+
+    size_t size;
+    std::unique_ptr<std::atomic<EventObserver*>[]> observers;
+  };
+
+  // A per key ordered subscriber, shared by the snapshots listing it.
+  struct ShardedSubscriber {
+    explicit ShardedSubscriber(int slot, Handler handler)
+        : slot(slot), handler(std::move(handler)), removed(false) {}
+
+    int slot;
+    Handler handler;
+    std::atomic<bool> removed;
+    std::shared_ptr<SubscriberCounters> counters;
+  };
+
+  // Per key ordered subscribers by event slot, never changed once
+  // published.
+  struct ShardedSnapshot {
+    std::vector<std::vector<ShardedSubscriber*>> slots;
+  };
+
+  // Bits of the subscriber handles, below the bits of the other kinds.
+  static const int kHandleRunnerBits = 3;
+  static const int kHandleGenerationBits = 39;
+  static const int kHandleLocalBits = 17;
+  static_assert(TaskRunner::THREAD_COUNT <= 1 << kHandleRunnerBits,
+                "Subscriber handles must hold the runner");
+
+  // Handles of per key ordered subscribers have this bit set.
+  static const SubscriptionHandle kShardedHandleBit = 1LL << 62;
+  // Handles of batch subscribers have this bit set, and their slot in the
+  // low bits.
+  static const SubscriptionHandle kBatchHandleBit = 1LL << 61;
+  static const int kBatchSlotBits = 10;
+  // Handles of isolated subscribers are the handle of the tap queueing their
+  // events with this bit set.
+  static const SubscriptionHandle kIsolatedHandleBit = 1LL << 60;
+  // Handles of taps have this bit set.
+  static const SubscriptionHandle kTapHandleBit = 1LL << 59;
+  static_assert(kHandleRunnerBits + kHandleGenerationBits + kHandleLocalBits
+                    <= 59,
+                "Subscriber handles must stay below kTapHandleBit");
+
+  // Object replaced at |epoch|.
+  struct Retired {
+    std::shared_ptr<void> object;
+    uint64_t epoch;
+  };
+
+  // Publishes |snapshot| and retires the current one, under
+  // |snapshots_lock_|. Returns the epoch of the replacement.
+  uint64_t PublishObservers(ObserverSnapshot* snapshot);
+  // Retires |objects| unlinked from the published snapshots, under
+  // |snapshots_lock_|. Returns the epoch of the retirement.
+  uint64_t Retire(std::initializer_list<std::shared_ptr<void>> objects);
+  void ReclaimSnapshots();
+
+  // Marks |runner| as reading the snapshots. A nested read keeps the epoch
+  // of the outermost one, which protects every snapshot read since.
+  void BeginRead(TaskRunner::ID runner);
+  void EndRead(TaskRunner::ID runner);
+  bool ReadersPast(uint64_t epoch) const;
+  // Waits until no dispatch started before |epoch| is still reading the
+  // snapshots. Returns at once when called from a dispatch, which may be
+  // the one waited for.
+  void WaitForReaders(uint64_t epoch) const;
 
   // Static instance
   static EventBus* s_instance;
 
-  std::list<EventObserver*> observers_;
+  std::atomic<ObserverSnapshot*> observers_;
+  // Size of |observers_|, so firing threads can check for observers without
+  // reading the snapshot.
+  std::atomic<size_t> observer_count_;
+  std::atomic<ShardedSnapshot*> sharded_;
+  // Serializes writers of the snapshots, readers never take it.
+  mutable std::mutex snapshots_lock_;
+  std::unordered_map<SubscriptionHandle, std::shared_ptr<ShardedSubscriber>>
+      sharded_subscribers_;
+  // Per event slot, true while it has per key ordered subscribers.
+  std::atomic<bool> has_sharded_[kMaxEventSlots];
+  SubscriptionHandle next_sharded_handle_ = 0;
+  std::vector<Retired> retired_;
+  // Advanced by every publication.
+  std::atomic<uint64_t> epoch_;
+  // Per runner, the epoch the dispatch reading the snapshots started at, 0
+  // when none is.
+  std::atomic<uint64_t> reader_epochs_[TaskRunner::THREAD_COUNT];
+  // Per runner, nesting of snapshot reads, only touched on that runner.
+  int reader_depths_[TaskRunner::THREAD_COUNT];
+
+  Registry registries_[TaskRunner::THREAD_COUNT];
+
+  // Per event slot, bit N is set if runner N has subscribers. Read by
+  // FireEvent on any thread to route events.
+  std::atomic<uint32_t> routes_[kMaxEventSlots];
+
+  std::mutex coalesce_lock_;
+  std::unordered_map<PendingKey, Event*, PendingKeyHash> coalesced_;
+
+  // Last sticky events by slot and key hash.
+  std::mutex sticky_lock_;
+  uint32_t sticky_sequence_ = 0;
+  std::unordered_map<
+      int, std::unordered_map<uint64_t, std::shared_ptr<const Event>>>
+      sticky_;
+
+  // Per event slot, null until a batch subscriber subscribes it.
+  std::atomic<BatchQueue*> batches_[kMaxEventSlots];
+  // Serializes the creation of batch queues.
+  std::mutex batches_lock_;
+  std::atomic<SubscriptionHandle> next_batch_handle_;
+
+  // Per event slot, advanced by every cancellation. Stamped on the fired
+  // events, those stamped before |canceled_before_| are dropped.
+  std::atomic<uint32_t> cancel_epochs_[kMaxEventSlots];
+  std::atomic<uint32_t> canceled_before_[kMaxEventSlots];
+  // Per event slot, true while |canceled_keys_| has keys for it.
+  std::atomic<bool> keyed_cancels_[kMaxEventSlots];
+  // Epoch the pending events of a key were canceled at. Read by dispatch as
+  // the other snapshots are, never changed once published.
+  using CanceledKeys = std::unordered_map<PendingKey, uint32_t, PendingKeyHash>;
+  std::atomic<CanceledKeys*> canceled_keys_;
+  // Set once, by the first cancellation of a key of the slot.
+  KeyHashFunction cancel_hashes_[kMaxEventSlots];
+
+  // Queues of the isolated subscribers, by handle.
+  std::mutex isolated_lock_;
+  std::unordered_map<SubscriptionHandle, std::shared_ptr<SubscriberQueue>>
+      isolated_;
+  // Spreads the isolated subscribers over the dispatch runners.
+  std::atomic<int> next_isolated_runner_;
+
+  struct Tap {
+    SubscriptionHandle handle;
+    TapHandler handler;
+  };
+
+  // Per event slot, true while it has taps, so firing threads only lock
+  // |taps_lock_| for tapped types.
+  std::atomic<bool> tapped_[kMaxEventSlots];
+  // Shared by the firing threads running taps.
+  std::shared_timed_mutex taps_lock_;
+  std::unordered_map<int, std::vector<Tap>> taps_;
+  SubscriptionHandle next_tap_handle_ = 0;
+
+  std::atomic<bool> metrics_enabled_;
+  // Counters of the live subscriptions, by handle. Only taken to subscribe,
+  // unsubscribe and export.
+  std::mutex counters_lock_;
+  std::unordered_map<SubscriptionHandle, std::shared_ptr<SubscriberCounters>>
+      counters_;
 
 };
 
@@ -0,0 +1,222 @@
+#ifndef CHERRY_EVENT_CODEC_H_
+#define CHERRY_EVENT_CODEC_H_
+
+#include "cherry/event_bus.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+namespace cherry {
+
+// Class CodecWriter ----------------------------------------------------------
+// Appends encoded values to a caller provided buffer.
+class CodecWriter {
+public:
+  CodecWriter(uint8_t* data, size_t capacity)
+      : data_(data), capacity_(capacity), size_(0), overflow_(false) {}
+
+  void Write(const void* bytes, size_t size) {
+    if (overflow_ || size > capacity_ - size_) {
+      overflow_ = true;
+      return;
+    }
+    memcpy(data_ + size_, bytes, size);
+    size_ += size;
+  }
+
+  size_t size() const { return size_; }
+  // True if a write didn't fit, the buffer content is incomplete then.
+  bool overflow() const { return overflow_; }
+
+private:
+  uint8_t* data_;
+  size_t capacity_;
+  size_t size_;
+  bool overflow_;
+
+};
+
+
+// Class CodecReader ----------------------------------------------------------
+class CodecReader {
+public:
+  CodecReader(const uint8_t* data, size_t size)
+      : data_(data), size_(size), offset_(0) {}
+
+  // Returns false if fewer than |size| bytes are left.
+  bool Read(void* bytes, size_t size) {
+    if (size > size_ - offset_)
+      return false;
+    memcpy(bytes, data_ + offset_, size);
+    offset_ += size;
+    return true;
+  }
+
+  size_t remaining() const { return size_ - offset_; }
+
+private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t offset_;
+
+};
+
+
+// Encodes values of type T as bytes in host order, for peers on the same
+// host. Trivially copyable types are copied as is, std::string and
+// std::vector are length prefixed. Specialize it for other parameter types.
+template <typename T, typename Enable = void>
+struct ParamCodec;
+
+template <typename T>
+struct ParamCodec<T,
+                  std::enable_if_t<std::is_trivially_copyable<T>::value>> {
+  static size_t Size(const T&) { return sizeof(T); }
+
+  static void Encode(const T& value, CodecWriter* writer) {
+    writer->Write(&value, sizeof(T));
+  }
+
+  static bool Decode(CodecReader* reader, T* value) {
+    return reader->Read(value, sizeof(T));
+  }
+};
+
+template <>
+struct ParamCodec<std::string> {
+  static size_t Size(const std::string& value) {
+    return sizeof(uint32_t) + value.size();
+  }
+
+  static void Encode(const std::string& value, CodecWriter* writer) {
+    uint32_t size = static_cast<uint32_t>(value.size());
+    writer->Write(&size, sizeof(size));
+    writer->Write(value.data(), size);
+  }
+
+  static bool Decode(CodecReader* reader, std::string* value) {
+    uint32_t size = 0;
+    if (!reader->Read(&size, sizeof(size)) || size > reader->remaining())
+      return false;
+    value->resize(size);
+    return reader->Read(&(*value)[0], size);
+  }
+};
+
+template <typename T, typename A>
+struct ParamCodec<std::vector<T, A>> {
+  static size_t Size(const std::vector<T, A>& value) {
+    size_t size = sizeof(uint32_t);
+    for (const T& element : value)
+      size += ParamCodec<T>::Size(element);
+    return size;
+  }
+
+  static void Encode(const std::vector<T, A>& value, CodecWriter* writer) {
+    uint32_t size = static_cast<uint32_t>(value.size());
+    writer->Write(&size, sizeof(size));
+    for (const T& element : value)
+      ParamCodec<T>::Encode(element, writer);
+  }
+
+  static bool Decode(CodecReader* reader, std::vector<T, A>* value) {
+    uint32_t size = 0;
+    if (!reader->Read(&size, sizeof(size)) || size > reader->remaining())
+      return false;
+    value->resize(size);
+    for (T& element : *value) {
+      if (!ParamCodec<T>::Decode(reader, &element))
+        return false;
+    }
+    return true;
+  }
+};
+
+
+// Encodes the fields of a tuple one after the other.
+template <typename Tuple>
+struct TupleCodec;
+
+template <typename... Ts>
+struct TupleCodec<std::tuple<Ts...>> {
+  using Tuple = std::tuple<Ts...>;
+
+  static size_t Size(const Tuple& tuple) {
+    return SizeImpl(tuple, std::index_sequence_for<Ts...>());
+  }
+
+  static void Encode(const Tuple& tuple, CodecWriter* writer) {
+    EncodeImpl(tuple, writer, std::index_sequence_for<Ts...>());
+  }
+
+  static bool Decode(CodecReader* reader, Tuple* tuple) {
+    return DecodeImpl(reader, tuple, std::index_sequence_for<Ts...>());
+  }
+
+private:
+  template <size_t... Ns>
+  static size_t SizeImpl(const Tuple& tuple, std::index_sequence<Ns...>) {
+    size_t size = 0;
+    int expand[] = {
+        0, (size += ParamCodec<Ts>::Size(std::get<Ns>(tuple)), 0)... };
+    (void)expand;
+    return size;
+  }
+
+  template <size_t... Ns>
+  static void EncodeImpl(const Tuple& tuple,
+                         CodecWriter* writer,
+                         std::index_sequence<Ns...>) {
+    int expand[] = {
+        0, (ParamCodec<Ts>::Encode(std::get<Ns>(tuple), writer), 0)... };
+    (void)expand;
+  }
+
+  template <size_t... Ns>
+  static bool DecodeImpl(CodecReader* reader,
+                         Tuple* tuple,
+                         std::index_sequence<Ns...>) {
+    bool ok = true;
+    int expand[] = {
+        0, (ok = ok && ParamCodec<Ts>::Decode(reader, &std::get<Ns>(*tuple)),
+            0)... };
+    (void)expand;
+    return ok;
+  }
+};
+
+
+// Encodes the parameters of EventType events, used to carry them to another
+// process.
+template <typename EventType>
+struct EventCodec {
+  using Param = typename EventType::Param;
+  using Codec = TupleCodec<Param>;
+
+  static size_t Size(const Event* event) {
+    return Codec::Size(static_cast<const EventType*>(event)->param());
+  }
+
+  static void Encode(const Event* event, CodecWriter* writer) {
+    Codec::Encode(static_cast<const EventType*>(event)->param(), writer);
+  }
+
+  // Returns null if |reader| doesn't hold exactly one encoded event.
+  static Event* Decode(CodecReader* reader) {
+    Param param;
+    if (!Codec::Decode(reader, &param) || reader->remaining() != 0)
+      return nullptr;
+    return new EventType(InPlace(), std::move(param));
+  }
+};
+
+} // namespace cherry
+
+#endif  // CHERRY_EVENT_CODEC_H_
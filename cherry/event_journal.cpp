@@ -0,0 +1,367 @@
+#include "cherry/event_journal.h"
+
+#include "cherry/task_runner.h"
+#include "cherry/time.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+
+namespace cherry {
+
+namespace {
+
+const uint64_t kJournalMagic = 0x4c4e524a59524843;  // "CHRYJRNL"
+const uint32_t kJournalVersion = 1;
+const size_t kRecordAlignment = 8;
+const size_t kMinSegmentSize = 4096;
+
+// At most this many bytes of records wait for IO, more are dropped.
+const size_t kMaxPendingBytes = 32 << 20;
+
+struct SegmentHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t index;
+};
+
+struct RecordHeader {
+  // Size of the record, header included. Zero past the last record.
+  uint32_t size;
+  int32_t event_id;
+  int64_t timestamp;
+};
+
+size_t AlignRecord(size_t size) {
+  return (size + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+std::string SegmentPath(const std::string& directory, uint32_t index) {
+  char name[32];
+  snprintf(name, sizeof(name), "/events.%06u.journal", index);
+  return directory + name;
+}
+
+// Removes the segments of a previous journal, numbered from 0 without gaps.
+// Left in place, those past the new last segment would be replayed.
+void RemoveSegments(const std::string& directory) {
+  for (uint32_t index = 0;; ++index) {
+    if (unlink(SegmentPath(directory, index).c_str()) != 0)
+      break;
+  }
+}
+
+} // namespace
+
+
+// Class EventJournal::Writer -------------------------------------------------
+// The pending buffer filled by the recording threads and the segment it is
+// copied to.
+class EventJournal::Writer {
+public:
+  Writer(const std::string& directory, size_t segment_size)
+      : directory_(directory),
+        segment_size_(segment_size),
+        index_(0),
+        mapping_(nullptr),
+        used_(0),
+        recorded_(0),
+        dropped_(0) {}
+
+  ~Writer() { CloseSegment(); }
+
+  bool OpenSegment();
+
+  // Encodes |event| at the end of the pending buffer. Sets |first| if the
+  // buffer was empty, IO needs to be told then.
+  bool Append(const Event* event,
+              size_t size,
+              const Encoder& encoder,
+              bool* first);
+
+  // Copies the pending records to the segments.
+  void Drain();
+
+  uint64_t recorded() const { return recorded_.load(); }
+  uint64_t dropped() const { return dropped_.load(); }
+
+private:
+  void Write(const uint8_t* record, size_t size);
+  void CloseSegment();
+
+  const std::string directory_;
+  const size_t segment_size_;
+
+  // Guards |pending_|.
+  std::mutex pending_lock_;
+  std::vector<uint8_t> pending_;
+
+  // Guards the segment and |writing_|, the pending records being written.
+  std::mutex write_lock_;
+  std::vector<uint8_t> writing_;
+  uint32_t index_;
+  uint8_t* mapping_;
+  size_t used_;
+
+  std::atomic<uint64_t> recorded_;
+  std::atomic<uint64_t> dropped_;
+
+};
+
+bool EventJournal::Writer::OpenSegment() {
+  std::string path = SegmentPath(directory_, index_);
+  int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644);
+  if (fd < 0)
+    return false;
+  if (ftruncate(fd, static_cast<off_t>(segment_size_)) != 0) {
+    close(fd);
+    return false;
+  }
+  void* mapping = mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return false;
+
+  mapping_ = static_cast<uint8_t*>(mapping);
+  SegmentHeader* header = reinterpret_cast<SegmentHeader*>(mapping_);
+  header->magic = kJournalMagic;
+  header->version = kJournalVersion;
+  header->index = index_;
+  used_ = sizeof(SegmentHeader);
+  return true;
+}
+
+void EventJournal::Writer::CloseSegment() {
+  if (!mapping_)
+    return;
+  munmap(mapping_, segment_size_);
+  mapping_ = nullptr;
+  // Gives back the unused end of the segment.
+  truncate(SegmentPath(directory_, index_).c_str(),
+           static_cast<off_t>(used_));
+}
+
+bool EventJournal::Writer::Append(const Event* event,
+                                  size_t size,
+                                  const Encoder& encoder,
+                                  bool* first) {
+  size_t record_size = sizeof(RecordHeader) + size;
+  size_t aligned_size = AlignRecord(record_size);
+  if (aligned_size > segment_size_ - sizeof(SegmentHeader)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(pending_lock_);
+  size_t offset = pending_.size();
+  if (offset + aligned_size > kMaxPendingBytes) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  pending_.resize(offset + aligned_size);
+  RecordHeader* record = reinterpret_cast<RecordHeader*>(&pending_[offset]);
+  record->size = static_cast<uint32_t>(record_size);
+  record->event_id = event->GetID();
+  record->timestamp = TimeTicks::Now().Microseconds();
+  CodecWriter writer(&pending_[offset + sizeof(RecordHeader)], size);
+  encoder.encode(event, &writer);
+  assert(!writer.overflow() && writer.size() == size);
+
+  *first = offset == 0;
+  recorded_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void EventJournal::Writer::Drain() {
+  std::lock_guard<std::mutex> write_guard(write_lock_);
+  {
+    std::lock_guard<std::mutex> guard(pending_lock_);
+    writing_.swap(pending_);
+  }
+
+  size_t offset = 0;
+  while (offset < writing_.size()) {
+    const RecordHeader* record =
+        reinterpret_cast<const RecordHeader*>(&writing_[offset]);
+    size_t size = AlignRecord(record->size);
+    Write(&writing_[offset], size);
+    offset += size;
+  }
+  // Keeps the capacity for the next swap.
+  writing_.clear();
+}
+
+void EventJournal::Writer::Write(const uint8_t* record, size_t size) {
+  if (mapping_ && used_ + size > segment_size_) {
+    CloseSegment();
+    ++index_;
+    OpenSegment();
+  }
+  if (!mapping_) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    recorded_.fetch_sub(1, std::memory_order_relaxed);
+    return;
+  }
+  memcpy(mapping_ + used_, record, size);
+  used_ += size;
+}
+
+
+// Class EventJournal ---------------------------------------------------------
+
+// static
+std::unique_ptr<EventJournal> EventJournal::Create(
+    const std::string& directory,
+    size_t segment_size) {
+  if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+    return nullptr;
+
+  segment_size = AlignRecord(segment_size);
+  if (segment_size < kMinSegmentSize)
+    segment_size = kMinSegmentSize;
+  RemoveSegments(directory);
+  std::shared_ptr<Writer> writer(new Writer(directory, segment_size));
+  if (!writer->OpenSegment())
+    return nullptr;
+  return std::unique_ptr<EventJournal>(new EventJournal(std::move(writer)));
+}
+
+EventJournal::EventJournal(std::shared_ptr<Writer> writer)
+    : writer_(std::move(writer)) {}
+
+EventJournal::~EventJournal() {
+  for (SubscriptionHandle handle : handles_)
+    EventBus::Unsubscribe(handle);
+  Flush();
+}
+
+void EventJournal::Flush() {
+  writer_->Drain();
+}
+
+uint64_t EventJournal::recorded() const {
+  return writer_->recorded();
+}
+
+uint64_t EventJournal::dropped() const {
+  return writer_->dropped();
+}
+
+void EventJournal::Append(const Event* event) {
+  Encoder encoder;
+  {
+    std::lock_guard<std::mutex> guard(encoders_lock_);
+    auto itr = encoders_.find(event->GetID());
+    if (itr == encoders_.end())
+      return;
+    encoder = itr->second;
+  }
+
+  bool first = false;
+  if (writer_->Append(event, encoder.size(event), encoder, &first) && first)
+    TaskRunner::PostTask(TaskRunner::IO, BindObj(writer_, &Writer::Drain));
+}
+
+void EventJournal::AddEncoder(int event_id,
+                              SizeFunction size,
+                              EncodeFunction encode) {
+  {
+    std::lock_guard<std::mutex> guard(encoders_lock_);
+    encoders_[event_id] = { size, encode };
+  }
+  handles_.push_back(EventBus::AddTap(
+      event_id, [this](const Event* event) { Append(event); }));
+}
+
+
+// Class JournalReplayer ------------------------------------------------------
+
+JournalReplayer::JournalReplayer(const std::string& directory)
+    : directory_(directory),
+      skipped_(0) {}
+
+uint64_t JournalReplayer::Run(Speed speed) {
+  uint64_t fired = 0;
+  skipped_ = 0;
+  bool started = false;
+  int64_t first_timestamp = 0;
+  TimeTicks start;
+
+  for (uint32_t index = 0;; ++index) {
+    int fd = open(SegmentPath(directory_, index).c_str(), O_RDONLY);
+    if (fd < 0)
+      break;
+    struct stat info;
+    if (fstat(fd, &info) != 0 ||
+        static_cast<size_t>(info.st_size) < sizeof(SegmentHeader)) {
+      close(fd);
+      break;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      break;
+
+    const uint8_t* data = static_cast<const uint8_t*>(mapping);
+    const SegmentHeader* header =
+        reinterpret_cast<const SegmentHeader*>(data);
+    if (header->magic != kJournalMagic || header->version != kJournalVersion) {
+      munmap(mapping, size);
+      break;
+    }
+
+    size_t offset = sizeof(SegmentHeader);
+    while (offset + sizeof(RecordHeader) <= size) {
+      const RecordHeader* record =
+          reinterpret_cast<const RecordHeader*>(data + offset);
+      // A writer which didn't close the segment leaves it zero filled.
+      if (record->size < sizeof(RecordHeader) ||
+          record->size > size - offset) {
+        break;
+      }
+      offset += AlignRecord(record->size);
+
+      auto itr = decoders_.find(record->event_id);
+      if (itr == decoders_.end()) {
+        ++skipped_;
+        continue;
+      }
+      CodecReader reader(reinterpret_cast<const uint8_t*>(record + 1),
+                         record->size - sizeof(RecordHeader));
+      Event* event = itr->second(&reader);
+      if (!event) {
+        ++skipped_;
+        continue;
+      }
+
+      if (speed == ORIGINAL_SPEED) {
+        if (!started) {
+          started = true;
+          first_timestamp = record->timestamp;
+          start = TimeTicks::Now();
+        }
+        int64_t delay = record->timestamp - first_timestamp -
+                        (TimeTicks::Now() - start).Microseconds();
+        if (delay > 0)
+          std::this_thread::sleep_for(std::chrono::microseconds(delay));
+      }
+      EventBus::FireEvent(event);
+      ++fired;
+    }
+    munmap(mapping, size);
+  }
+  return fired;
+}
+
+} // namespace cherry
@@ -0,0 +1,122 @@
+#ifndef CHERRY_EVENT_JOURNAL_H_
+#define CHERRY_EVENT_JOURNAL_H_
+
+#include "cherry/event_bus.h"
+#include "cherry/event_codec.h"
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace cherry {
+
+// Class EventJournal ---------------------------------------------------------
+// Records events to a log of memory mapped segment files in a directory,
+// events.000000.journal, events.000001.journal and so on. A record holds the
+// event ID, the time it was recorded and the parameters encoded by the
+// EventCodec of the event type. Recording only encodes the event into a
+// pending buffer, the buffer is copied to the segments on IO, so the
+// recording thread never waits on the disk. A JournalReplayer plays the
+// journal back. POSIX only.
+class EventJournal {
+public:
+  virtual ~EventJournal();
+
+  // Creates the journal in |directory|, created if needed, replacing the
+  // segments of a previous journal. A new segment of |segment_size| bytes
+  // is started when one is full. Returns null on failure.
+  static std::unique_ptr<EventJournal> Create(const std::string& directory,
+                                              size_t segment_size);
+
+  // Records the EventType events, subscribers still get them. Events are
+  // encoded by a tap on the thread firing them, whatever the subscribers do
+  // with them, see EventBus::AddTap. Events which don't fit in a segment or
+  // arrive while IO is too far behind are dropped and counted.
+  template <typename EventType>
+  void Record() {
+    AddEncoder(EventType::ID, &EventCodec<EventType>::Size,
+               &EventCodec<EventType>::Encode);
+  }
+
+  // Writes the pending records on the calling thread instead of waiting
+  // for IO.
+  void Flush();
+
+  // Number of events recorded and dropped so far.
+  uint64_t recorded() const;
+  uint64_t dropped() const;
+
+private:
+  class Writer;
+
+  using SizeFunction = size_t (*)(const Event* event);
+  using EncodeFunction = void (*)(const Event* event, CodecWriter* writer);
+
+  struct Encoder {
+    SizeFunction size;
+    EncodeFunction encode;
+  };
+
+  explicit EventJournal(std::shared_ptr<Writer> writer);
+
+  void AddEncoder(int event_id, SizeFunction size, EncodeFunction encode);
+  // Tap of the recorded event types.
+  void Append(const Event* event);
+
+  // Owned with the IO tasks draining it, which do nothing once the journal
+  // is destroyed.
+  std::shared_ptr<Writer> writer_;
+
+  // Guards |encoders_|.
+  std::mutex encoders_lock_;
+  std::unordered_map<int, Encoder> encoders_;
+  std::vector<SubscriptionHandle> handles_;
+
+};
+
+
+// Class JournalReplayer ------------------------------------------------------
+// Fires the events of a journal written by EventJournal on the bus again,
+// either spaced as they were recorded or as fast as possible, which also
+// makes a recorded session a realistic load for benchmarks.
+class JournalReplayer {
+public:
+  enum Speed {
+    ORIGINAL_SPEED,
+    MAX_SPEED,
+  };
+
+  explicit JournalReplayer(const std::string& directory);
+
+  // Replays the EventType events, others are skipped.
+  template <typename EventType>
+  void Replay() {
+    decoders_[EventType::ID] = &EventCodec<EventType>::Decode;
+  }
+
+  // Fires the events of every segment in order and returns how many were
+  // fired. Blocks the caller until the last one is fired, so it shouldn't
+  // run on EVENT.
+  uint64_t Run(Speed speed);
+
+  // Number of records skipped by the last Run, of event types not replayed
+  // or which failed to decode.
+  uint64_t skipped() const { return skipped_; }
+
+private:
+  using DecodeFunction = Event* (*)(CodecReader* reader);
+
+  std::string directory_;
+  std::unordered_map<int, DecodeFunction> decoders_;
+  uint64_t skipped_;
+
+};
+
+} // namespace cherry
+
+#endif  // CHERRY_EVENT_JOURNAL_H_
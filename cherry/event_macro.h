@@ -7,7 +7,8 @@
 
 
 #define EVENT_TUPLE(...) CheckedTuple<__VA_ARGS__>::Tuple
-#define EVENT_ID() ((EVENT_START << 16) + __LINE__)
+#define EVENT_ID(event_name) \
+  cherry::HashEventName(#event_name, EVENT_START)
 #define EVENT_START Cherry_EventStart
 
 #define EVENT_DEFINE(event_name, ...) \
@@ -23,9 +24,67 @@
 #define EVENT_DECL(event_name, in_tuple) \
   struct event_name##_Meta { \
     using InTuple = in_tuple; \
-    enum { ID = EVENT_ID() }; \
+    enum { ID = EVENT_ID(event_name) }; \
   }; \
-  using event_name = cherry::EventT<event_name##_Meta>;
+  using event_name = cherry::EventT<event_name##_Meta>; \
+  EVENT_REGISTER(event_name)
+
+#define EVENT_REGISTER(event_name) \
+  static const cherry::EventRegistrar event_name##_Registrar( \
+      event_name##_Meta::ID, #event_name, event_name::TypeTag());
+
+// Pending events of a coalesced type are merged into one, by type or by the
+// value of their first parameter. See cherry::CoalescedEventT.
+#define EVENT_DEFINE_COALESCED(event_name, ...) \
+  EVENT_DECL_COALESCED(event_name, EVENT_TUPLE(__VA_ARGS__), false)
+#define EVENT_DEFINE_COALESCED_BY_KEY(event_name, ...) \
+  EVENT_DECL_COALESCED(event_name, EVENT_TUPLE(__VA_ARGS__), true)
+
+#define EVENT_DECL_COALESCED(event_name, in_tuple, keyed) \
+  struct event_name##_Meta { \
+    using InTuple = in_tuple; \
+    enum { ID = EVENT_ID(event_name) }; \
+  }; \
+  using event_name = cherry::CoalescedEventT<event_name##_Meta, keyed>; \
+  EVENT_REGISTER(event_name)
+
+// The last event of a sticky type, or of each value of its first parameter,
+// is kept and handed to the subscribers made later. See
+// cherry::StickyEventT.
+#define EVENT_DEFINE_STICKY(event_name, ...) \
+  EVENT_DECL_STICKY(event_name, EVENT_TUPLE(__VA_ARGS__), false)
+#define EVENT_DEFINE_STICKY_BY_KEY(event_name, ...) \
+  EVENT_DECL_STICKY(event_name, EVENT_TUPLE(__VA_ARGS__), true)
+
+#define EVENT_DECL_STICKY(event_name, in_tuple, keyed) \
+  struct event_name##_Meta { \
+    using InTuple = in_tuple; \
+    enum { ID = EVENT_ID(event_name) }; \
+  }; \
+  using event_name = cherry::StickyEventT<event_name##_Meta, keyed>; \
+  EVENT_REGISTER(event_name)
+
+// Request events replied to by their handler, e.g.
+//   EVENT_DEFINE_RPC(Lookup, (std::string), (bool, int))
+// See cherry::RpcEventT.
+#define EVENT_DEFINE_RPC(event_name, ins, outs) \
+  struct event_name##_Meta { \
+    using InTuple = EVENT_TUPLE ins; \
+    using OutTuple = EVENT_TUPLE outs; \
+    enum { ID = EVENT_ID(event_name) }; \
+  }; \
+  using event_name = cherry::RpcEventT<event_name##_Meta>; \
+  EVENT_REGISTER(event_name)
+
+// Urgent events are handled before the ordinary ones already pending. See
+// cherry::UrgentEventT.
+#define EVENT_DEFINE_URGENT(event_name, ...) \
+  struct event_name##_Meta { \
+    using InTuple = EVENT_TUPLE(__VA_ARGS__); \
+    enum { ID = EVENT_ID(event_name) }; \
+  }; \
+  using event_name = cherry::UrgentEventT<event_name##_Meta>; \
+  EVENT_REGISTER(event_name)
 
 
 #define BEGIN_EVENT_MAP(class_name, e) \
@@ -62,6 +121,6 @@ enum EventStart {
 
 
 // Event define.
-EVENT_DEFINE0(Cherry_Stop)
+EVENT_DEFINE_URGENT(Cherry_Stop)
 
 #endif  // CHERRY_EVENT_MACRO_H_
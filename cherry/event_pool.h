@@ -0,0 +1,123 @@
+#ifndef CHERRY_EVENT_POOL_H_
+#define CHERRY_EVENT_POOL_H_
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <vector>
+
+
+namespace cherry {
+
+// Class EventPool ------------------------------------------------------------
+// Recycles the storage of events of type T. Each thread keeps a cache of free
+// blocks, blocks released on a thread go to its cache. Caches exchange blocks
+// in batches through a shared list, so an event created on one thread and
+// destroyed on another costs one lock per batch instead of a malloc/free.
+template <typename T>
+class EventPool {
+public:
+  // Number of blocks moved between a thread cache and the shared list.
+  static const size_t kBatchSize = 64;
+  // Blocks kept in the shared list, the rest is returned to the heap.
+  static const size_t kMaxSharedBlocks = 64 * kBatchSize;
+
+  static void* Allocate() {
+    if (CacheGone())
+      return ::operator new(sizeof(T));
+    Cache& cache = LocalCache();
+    if (cache.blocks.empty())
+      Refill(&cache);
+    if (cache.blocks.empty())
+      return ::operator new(sizeof(T));
+    void* block = cache.blocks.back();
+    cache.blocks.pop_back();
+    return block;
+  }
+
+  static void Release(void* block) {
+    // Events still queued when the thread exits, such as shared ones
+    // released by static destructors, outlive the cache.
+    if (CacheGone()) {
+      ::operator delete(block);
+      return;
+    }
+    Cache& cache = LocalCache();
+    cache.blocks.push_back(block);
+    if (cache.blocks.size() >= 2 * kBatchSize)
+      Flush(&cache, kBatchSize);
+  }
+
+private:
+  struct Cache {
+    Cache() { blocks.reserve(2 * kBatchSize); }
+    ~Cache() {
+      Flush(this, blocks.size());
+      CacheGone() = true;
+    }
+
+    std::vector<void*> blocks;
+  };
+
+  struct Shared {
+    ~Shared() {
+      for (void* block : blocks)
+        ::operator delete(block);
+    }
+
+    std::mutex lock;
+    std::vector<void*> blocks;
+  };
+
+  static Cache& LocalCache() {
+    static thread_local Cache cache;
+    return cache;
+  }
+
+  // Set once the cache of the thread is destroyed.
+  static bool& CacheGone() {
+    static thread_local bool gone = false;
+    return gone;
+  }
+
+  static Shared& GetShared() {
+    static Shared shared;
+    return shared;
+  }
+
+  static void Refill(Cache* cache) {
+    Shared& shared = GetShared();
+    std::lock_guard<std::mutex> lock(shared.lock);
+    size_t count = std::min(kBatchSize, shared.blocks.size());
+    cache->blocks.insert(cache->blocks.end(),
+                         shared.blocks.end() - count, shared.blocks.end());
+    shared.blocks.resize(shared.blocks.size() - count);
+  }
+
+  // Moves the |count| most recently released blocks out of |cache|.
+  static void Flush(Cache* cache, size_t count) {
+    Shared& shared = GetShared();
+    auto first = cache->blocks.end() - count;
+    {
+      std::lock_guard<std::mutex> lock(shared.lock);
+      while (first != cache->blocks.end() &&
+             shared.blocks.size() < kMaxSharedBlocks) {
+        shared.blocks.push_back(*first++);
+      }
+    }
+    for (auto itr = first; itr != cache->blocks.end(); ++itr)
+      ::operator delete(*itr);
+    cache->blocks.resize(cache->blocks.size() - count);
+  }
+
+};
+
+template <typename T>
+const size_t EventPool<T>::kBatchSize;
+
+template <typename T>
+const size_t EventPool<T>::kMaxSharedBlocks;
+
+} // namespace cherry
+
+#endif  // CHERRY_EVENT_POOL_H_
@@ -0,0 +1,122 @@
+#include "cherry/event_transport.h"
+
+#include <assert.h>
+
+
+namespace cherry {
+
+namespace {
+
+// How long the receiving thread sleeps at most before checking whether it
+// is stopped.
+const int kReceiveWaitMs = 100;
+
+} // namespace
+
+
+// Class EventTransport -------------------------------------------------------
+
+// static
+std::unique_ptr<EventTransport> EventTransport::Create(
+    const std::string& name,
+    size_t capacity) {
+  std::unique_ptr<ShmRing> out = ShmRing::Create(RingName(name, true),
+                                                 capacity);
+  std::unique_ptr<ShmRing> in = ShmRing::Create(RingName(name, false),
+                                                capacity);
+  if (!out || !in)
+    return nullptr;
+  return std::unique_ptr<EventTransport>(
+      new EventTransport(std::move(out), std::move(in)));
+}
+
+// static
+std::unique_ptr<EventTransport> EventTransport::Open(const std::string& name) {
+  // The creator's rings seen from the other side.
+  std::unique_ptr<ShmRing> out = ShmRing::Open(RingName(name, false));
+  std::unique_ptr<ShmRing> in = ShmRing::Open(RingName(name, true));
+  if (!out || !in)
+    return nullptr;
+  return std::unique_ptr<EventTransport>(
+      new EventTransport(std::move(out), std::move(in)));
+}
+
+EventTransport::EventTransport(std::unique_ptr<ShmRing> out,
+                               std::unique_ptr<ShmRing> in)
+    : out_(std::move(out)),
+      in_(std::move(in)),
+      running_(false),
+      dropped_(0) {}
+
+EventTransport::~EventTransport() {
+  Stop();
+  for (SubscriptionHandle handle : handles_)
+    EventBus::Unsubscribe(handle);
+}
+
+// static
+std::string EventTransport::RingName(const std::string& name, bool to_peer) {
+  return name + (to_peer ? ".0" : ".1");
+}
+
+void EventTransport::Start() {
+  assert(!running_);
+  running_ = true;
+  thread_ = std::thread(&EventTransport::ReceiveLoop, this);
+}
+
+void EventTransport::Stop() {
+  if (!running_)
+    return;
+  running_ = false;
+  in_->Wake();
+  thread_.join();
+}
+
+void EventTransport::Send(const Event* event) {
+  std::lock_guard<std::mutex> guard(out_lock_);
+  auto itr = encoders_.find(event->GetID());
+  if (itr == encoders_.end())
+    return;
+
+  size_t size = itr->second.size(event);
+  uint8_t* data = out_->Reserve(size);
+  if (!data) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  CodecWriter writer(data, size);
+  itr->second.encode(event, &writer);
+  assert(!writer.overflow() && writer.size() == size);
+  out_->Commit(static_cast<uint32_t>(event->GetID()));
+}
+
+void EventTransport::AddEncoder(int event_id,
+                                SizeFunction size,
+                                EncodeFunction encode) {
+  {
+    std::lock_guard<std::mutex> guard(out_lock_);
+    encoders_[event_id] = { size, encode };
+  }
+  handles_.push_back(EventBus::AddTap(
+      event_id, [this](const Event* event) { Send(event); }));
+}
+
+void EventTransport::ReceiveLoop() {
+  auto decode = [this](uint32_t tag, const uint8_t* data, size_t size) {
+    auto itr = decoders_.find(static_cast<int>(tag));
+    if (itr == decoders_.end())
+      return;
+    CodecReader reader(data, size);
+    Event* event = itr->second(&reader);
+    if (event)
+      EventBus::FireEvent(event);
+  };
+
+  while (running_) {
+    if (!in_->Consume(decode))
+      in_->Wait(TimeDelta::FromMilliseconds(kReceiveWaitMs));
+  }
+}
+
+} // namespace cherry
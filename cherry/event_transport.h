@@ -0,0 +1,98 @@
+#ifndef CHERRY_EVENT_TRANSPORT_H_
+#define CHERRY_EVENT_TRANSPORT_H_
+
+#include "cherry/event_bus.h"
+#include "cherry/event_codec.h"
+#include "cherry/shm_ring.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace cherry {
+
+// Class EventTransport -------------------------------------------------------
+// Carries events between the EventBus of two processes of the host over a
+// pair of ShmRing, one per direction. Forwarded events are encoded by their
+// EventCodec straight into the shared ring, received ones are decoded
+// straight from it by a receiving thread and fired on the local bus. An
+// event type should not be both forwarded and received by a process, it
+// would bounce back. Linux only.
+class EventTransport {
+public:
+  virtual ~EventTransport();
+
+  // Creates the rings of the transport |name|, by the first process.
+  // Returns null on failure.
+  static std::unique_ptr<EventTransport> Create(const std::string& name,
+                                                size_t capacity);
+  // Opens the rings created by the peer. Returns null on failure.
+  static std::unique_ptr<EventTransport> Open(const std::string& name);
+
+  // Forwards the EventType events fired in this process to the peer, local
+  // subscribers still get them. Events are encoded by a tap on the thread
+  // firing them, whatever the local subscribers do with them, see
+  // EventBus::AddTap. An event which doesn't fit in the ring is dropped and
+  // counted.
+  template <typename EventType>
+  void Forward() {
+    AddEncoder(EventType::ID, &EventCodec<EventType>::Size,
+               &EventCodec<EventType>::Encode);
+  }
+
+  // Fires the EventType events received from the peer on the local bus.
+  // Must be called before Start.
+  template <typename EventType>
+  void Receive() {
+    decoders_[EventType::ID] = &EventCodec<EventType>::Decode;
+  }
+
+  // Starts and stops the receiving thread.
+  void Start();
+  void Stop();
+
+  // Number of events dropped because the ring to the peer was full.
+  uint64_t dropped() const { return dropped_.load(); }
+
+private:
+  using SizeFunction = size_t (*)(const Event* event);
+  using EncodeFunction = void (*)(const Event* event, CodecWriter* writer);
+  using DecodeFunction = Event* (*)(CodecReader* reader);
+
+  struct Encoder {
+    SizeFunction size;
+    EncodeFunction encode;
+  };
+
+  EventTransport(std::unique_ptr<ShmRing> out, std::unique_ptr<ShmRing> in);
+
+  static std::string RingName(const std::string& name, bool to_peer);
+
+  void AddEncoder(int event_id, SizeFunction size, EncodeFunction encode);
+  // Tap of the forwarded event types.
+  void Send(const Event* event);
+  void ReceiveLoop();
+
+  std::unique_ptr<ShmRing> out_;
+  std::unique_ptr<ShmRing> in_;
+
+  // Guards |out_| and |encoders_| against threads forwarding concurrently.
+  std::mutex out_lock_;
+  std::unordered_map<int, Encoder> encoders_;
+  std::vector<SubscriptionHandle> handles_;
+
+  std::unordered_map<int, DecodeFunction> decoders_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+  std::atomic<uint64_t> dropped_;
+
+};
+
+} // namespace cherry
+
+#endif  // CHERRY_EVENT_TRANSPORT_H_
@@ -0,0 +1,106 @@
+#ifndef CHERRY_MPSC_QUEUE_H_
+#define CHERRY_MPSC_QUEUE_H_
+
+#include "cherry/spsc_queue.h"
+
+#include <atomic>
+#include <new>
+#include <utility>
+
+
+namespace cherry {
+
+// Class MpscQueue ------------------------------------------------------------
+// Unbounded linked queue for any number of producer threads and one consumer
+// thread. A push allocates a node and links it with a single atomic exchange,
+// producers never wait for each other nor for the consumer. The consumer
+// finds nothing while a producer is between its exchange and the link to the
+// previous node, a window of a couple of instructions.
+template <typename T>
+class MpscQueue {
+public:
+  MpscQueue() : head_(&stub_), tail_(&stub_) {}
+
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  ~MpscQueue() {
+    while (Consume([](T&&) {})) {}
+  }
+
+  // Producer side, can be called from any thread.
+  void Push(T&& value) {
+    Node* node = new Node;
+    new (node->storage) T(std::move(value));
+    Link(node);
+  }
+
+  // Consumer side. Moves the oldest element out of the queue and passes it
+  // to |consumer|. Returns false if the queue is empty or the oldest push is
+  // still in progress.
+  template <typename Consumer>
+  bool Consume(Consumer&& consumer) {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (!next)
+        return false;
+      // Skips the stub.
+      tail_ = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (!next) {
+      if (tail != head_.load(std::memory_order_acquire))
+        return false;
+      // |tail| is the last node, the stub goes behind it so it can be
+      // released.
+      Link(&stub_);
+      next = tail->next.load(std::memory_order_acquire);
+      if (!next)
+        return false;
+    }
+    tail_ = next;
+    T* slot = reinterpret_cast<T*>(tail->storage);
+    T value(std::move(*slot));
+    slot->~T();
+    delete tail;
+    consumer(std::move(value));
+    return true;
+  }
+
+  // Consumer side. False while a push is in progress.
+  bool Empty() const {
+    return tail_ == &stub_ &&
+           head_.load(std::memory_order_acquire) == &stub_;
+  }
+
+private:
+  struct Node {
+    std::atomic<Node*> next{nullptr};
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  void Link(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* previous = head_.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  // Last pushed node, written by the producers.
+  std::atomic<Node*> head_;
+
+  char pad0_[kCacheLineSize];
+
+  // Oldest node, only touched by the consumer.
+  Node* tail_;
+  // Placeholder keeping the list non empty, holds no value.
+  Node stub_;
+
+  char pad1_[kCacheLineSize];
+
+};
+
+} // namespace cherry
+
+#endif  // CHERRY_MPSC_QUEUE_H_
@@ -0,0 +1,186 @@
+#include "cherry/shm_ring.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+
+
+namespace cherry {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "Shared memory atomics must be lock free");
+
+namespace {
+
+const size_t kRecordAlignment = 8;
+
+int Futex(std::atomic<uint32_t>* word, int op, uint32_t value,
+          const struct timespec* timeout) {
+  return static_cast<int>(syscall(SYS_futex, reinterpret_cast<uint32_t*>(word),
+                                  op, value, timeout, nullptr, 0));
+}
+
+size_t RoundUpToPowerOfTwo(size_t value) {
+  size_t result = kRecordAlignment;
+  while (result < value)
+    result <<= 1;
+  return result;
+}
+
+} // namespace
+
+
+// Class ShmRing --------------------------------------------------------------
+
+// static
+std::unique_ptr<ShmRing> ShmRing::Create(const std::string& name,
+                                         size_t capacity) {
+  capacity = RoundUpToPowerOfTwo(capacity);
+  size_t size = sizeof(Header) + capacity;
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    return nullptr;
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+  void* mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    shm_unlink(name.c_str());
+    return nullptr;
+  }
+
+  Header* header = new (mapping) Header;
+  header->head.store(0, std::memory_order_relaxed);
+  header->tail.store(0, std::memory_order_relaxed);
+  header->wake_sequence.store(0, std::memory_order_relaxed);
+  header->sleeping.store(0, std::memory_order_relaxed);
+  header->capacity = capacity;
+  return std::unique_ptr<ShmRing>(new ShmRing(name, true, mapping, size));
+}
+
+// static
+std::unique_ptr<ShmRing> ShmRing::Open(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0)
+    return nullptr;
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(Header)) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = static_cast<size_t>(info.st_size);
+  void* mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return nullptr;
+  if (static_cast<Header*>(mapping)->capacity + sizeof(Header) != size) {
+    munmap(mapping, size);
+    return nullptr;
+  }
+  return std::unique_ptr<ShmRing>(new ShmRing(name, false, mapping, size));
+}
+
+ShmRing::ShmRing(const std::string& name,
+                 bool owner,
+                 void* mapping,
+                 size_t size)
+    : name_(name),
+      owner_(owner),
+      mapping_(mapping),
+      mapping_size_(size),
+      header_(static_cast<Header*>(mapping)),
+      data_(static_cast<uint8_t*>(mapping) + sizeof(Header)),
+      mask_(header_->capacity - 1) {}
+
+ShmRing::~ShmRing() {
+  munmap(mapping_, mapping_size_);
+  if (owner_)
+    shm_unlink(name_.c_str());
+}
+
+uint8_t* ShmRing::Reserve(size_t size) {
+  assert(reserved_size_ == 0);
+  uint64_t capacity = header_->capacity;
+  size_t record_size = RecordSize(size);
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  // A record doesn't wrap, the end of the ring is padded instead.
+  uint64_t contiguous = capacity - (tail & mask_);
+  uint64_t padding = record_size > contiguous ? contiguous : 0;
+  if (tail + padding + record_size - head > capacity)
+    return nullptr;
+
+  if (padding) {
+    RecordHeader* record = RecordAt(tail);
+    record->size = static_cast<uint32_t>(padding - sizeof(RecordHeader));
+    record->tag = kPaddingTag;
+    tail += padding;
+  }
+  reserved_ = tail;
+  reserved_size_ = size;
+  return DataAt(tail);
+}
+
+void ShmRing::Commit(uint32_t tag) {
+  assert(tag != kPaddingTag);
+  RecordHeader* record = RecordAt(reserved_);
+  record->size = static_cast<uint32_t>(reserved_size_);
+  record->tag = tag;
+  header_->tail.store(reserved_ + RecordSize(reserved_size_),
+                      std::memory_order_release);
+  reserved_size_ = 0;
+
+  // Pairs with the fence in Wait, either the consumer sees the record or
+  // this sees it sleeping.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->sleeping.load(std::memory_order_relaxed))
+    Wake();
+}
+
+void ShmRing::Wait(TimeDelta timeout) {
+  uint32_t sequence = header_->wake_sequence.load(std::memory_order_acquire);
+  header_->sleeping.store(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (header_->head.load(std::memory_order_relaxed) ==
+      header_->tail.load(std::memory_order_acquire)) {
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout.Microseconds() / 1000000);
+    ts.tv_nsec = static_cast<long>(timeout.Microseconds() % 1000000 * 1000);
+    Futex(&header_->wake_sequence, FUTEX_WAIT, sequence, &ts);
+  }
+  header_->sleeping.store(0, std::memory_order_relaxed);
+}
+
+void ShmRing::Wake() {
+  header_->wake_sequence.fetch_add(1, std::memory_order_release);
+  Futex(&header_->wake_sequence, FUTEX_WAKE, 1, nullptr);
+}
+
+// static
+size_t ShmRing::RecordSize(size_t size) {
+  size_t total = sizeof(RecordHeader) + size;
+  return (total + kRecordAlignment - 1) & ~(kRecordAlignment - 1);
+}
+
+ShmRing::RecordHeader* ShmRing::RecordAt(uint64_t position) const {
+  return reinterpret_cast<RecordHeader*>(data_ + (position & mask_));
+}
+
+uint8_t* ShmRing::DataAt(uint64_t position) const {
+  return data_ + (position & mask_) + sizeof(RecordHeader);
+}
+
+} // namespace cherry
@@ -0,0 +1,113 @@
+#ifndef CHERRY_SHM_RING_H_
+#define CHERRY_SHM_RING_H_
+
+#include "cherry/spsc_queue.h"
+#include "cherry/time.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+
+namespace cherry {
+
+// Class ShmRing --------------------------------------------------------------
+// Single producer single consumer ring of variable size records in POSIX
+// shared memory, shared by two processes of the host. Records are written
+// and read in place. A consumer with nothing to read sleeps on a futex in
+// the shared header, the producer only makes the wake up system call when
+// it does. Linux only.
+class ShmRing {
+public:
+  ~ShmRing();
+
+  // Creates the ring |name|, a POSIX shared memory name such as "/cherry",
+  // with |capacity| bytes of records rounded up to a power of two. The
+  // creator unlinks the name when destroyed. Returns null on failure.
+  static std::unique_ptr<ShmRing> Create(const std::string& name,
+                                         size_t capacity);
+  // Opens the ring created by another process. Returns null on failure.
+  static std::unique_ptr<ShmRing> Open(const std::string& name);
+
+  // Producer side. Reserves |size| bytes for the next record, returns null
+  // if the ring is full. Commit publishes the record with |tag|.
+  uint8_t* Reserve(size_t size);
+  void Commit(uint32_t tag);
+
+  // Consumer side. Calls |consumer|(tag, data, size) for the next record,
+  // returns false if there is none. The data is only valid during the call.
+  template <typename Consumer>
+  bool Consume(Consumer&& consumer);
+
+  // Waits until a record is committed, Wake is called or |timeout| passes.
+  void Wait(TimeDelta timeout);
+  // Wakes the waiting consumer.
+  void Wake();
+
+private:
+  struct Header;
+
+  struct RecordHeader {
+    uint32_t size;
+    uint32_t tag;
+  };
+
+  // Tag of the records filling the end of the ring when a record doesn't
+  // fit there.
+  static const uint32_t kPaddingTag = 0xffffffff;
+
+  ShmRing(const std::string& name, bool owner, void* mapping, size_t size);
+
+  static size_t RecordSize(size_t size);
+  RecordHeader* RecordAt(uint64_t position) const;
+  uint8_t* DataAt(uint64_t position) const;
+
+  std::string name_;
+  bool owner_;
+  void* mapping_;
+  size_t mapping_size_;
+  Header* header_;
+  uint8_t* data_;
+  uint64_t mask_;
+
+  // Producer side, the position and size of the reserved record.
+  uint64_t reserved_ = 0;
+  size_t reserved_size_ = 0;
+
+};
+
+
+struct ShmRing::Header {
+  // Consumer position, in bytes since the start.
+  alignas(kCacheLineSize) std::atomic<uint64_t> head;
+  // Producer position.
+  alignas(kCacheLineSize) std::atomic<uint64_t> tail;
+  // Futex word, bumped to wake the consumer, and whether it sleeps.
+  alignas(kCacheLineSize) std::atomic<uint32_t> wake_sequence;
+  std::atomic<uint32_t> sleeping;
+  uint64_t capacity;
+};
+
+template <typename Consumer>
+bool ShmRing::Consume(Consumer&& consumer) {
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(std::memory_order_acquire);
+  while (head != tail) {
+    const RecordHeader* record = RecordAt(head);
+    uint64_t next = head + RecordSize(record->size);
+    if (record->tag != kPaddingTag) {
+      consumer(record->tag, DataAt(head), static_cast<size_t>(record->size));
+      header_->head.store(next, std::memory_order_release);
+      return true;
+    }
+    head = next;
+    header_->head.store(head, std::memory_order_release);
+  }
+  return false;
+}
+
+} // namespace cherry
+
+#endif  // CHERRY_SHM_RING_H_
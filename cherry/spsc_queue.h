@@ -0,0 +1,118 @@
+#ifndef CHERRY_SPSC_QUEUE_H_
+#define CHERRY_SPSC_QUEUE_H_
+
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <utility>
+
+
+namespace cherry {
+
+constexpr size_t kCacheLineSize = 64;
+
+// Class SpscQueue ------------------------------------------------------------
+// Bounded lock free ring for exactly one producer thread and one consumer
+// thread. The producer cursor and the consumer cursor live on separate cache
+// lines, each side also caches the last seen cursor of the other side so the
+// shared line is only read when the ring looks full or empty. Only
+// acquire/release ordering is used.
+template <typename T>
+class SpscQueue {
+public:
+  // |capacity| is rounded up to a power of two.
+  explicit SpscQueue(size_t capacity)
+      : capacity_(RoundUpToPowerOfTwo(capacity)),
+        mask_(capacity_ - 1),
+        slots_(new Slot[capacity_]) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  ~SpscQueue() {
+    while (Consume([](T&&) {})) {}
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  // Producer side. Returns false if the ring is full, |value| is untouched
+  // in that case.
+  bool Push(T&& value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == capacity_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == capacity_)
+        return false;
+    }
+    new (slots_[tail & mask_].storage) T(std::move(value));
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Moves the oldest element out of the ring and passes it to
+  // |consumer| after its slot has been released. Returns false if the ring is
+  // empty.
+  template <typename Consumer>
+  bool Consume(Consumer&& consumer) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_)
+        return false;
+    }
+    T* slot = reinterpret_cast<T*>(slots_[head & mask_].storage);
+    T value(std::move(*slot));
+    slot->~T();
+    head_.store(head + 1, std::memory_order_release);
+    consumer(std::move(value));
+    return true;
+  }
+
+  // Consumer side. Reloads the producer cursor when the ring looks empty.
+  bool Empty() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head != cached_tail_)
+      return false;
+    cached_tail_ = tail_.load(std::memory_order_acquire);
+    return head == cached_tail_;
+  }
+
+private:
+  struct Slot {
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t value) {
+    assert(value > 0);
+    size_t result = 1;
+    while (result < value)
+      result <<= 1;
+    return result;
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  char pad0_[kCacheLineSize];
+
+  // Written by the consumer.
+  std::atomic<size_t> head_{0};
+  // Consumer's copy of |tail_|.
+  size_t cached_tail_ = 0;
+
+  char pad1_[kCacheLineSize];
+
+  // Written by the producer.
+  std::atomic<size_t> tail_{0};
+  // Producer's copy of |head_|.
+  size_t cached_head_ = 0;
+
+  char pad2_[kCacheLineSize];
+
+};
+
+} // namespace cherry
+
+#endif  // CHERRY_SPSC_QUEUE_H_
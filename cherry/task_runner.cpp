@@ -7,9 +7,23 @@
 
 namespace cherry {
 
+// Maximum number of tasks taken from one channel per DoChannelWork call, so a
+// busy channel can't starve the incomming queue.
+const int kMaxChannelTasksPerPoll = 64;
+
 std::shared_ptr<TaskRunner> g_task_runners[TaskRunner::THREAD_COUNT];
 
+thread_local TaskRunner::ID g_current_id = TaskRunner::THREAD_COUNT;
+
+// Threads of the dispatch runners once started, joined by RunAll.
+std::mutex g_dispatch_threads_lock;
+std::vector<std::thread> g_dispatch_threads;
+// Guarded by |g_dispatch_threads_lock|, only set while RunAll runs.
+bool g_dispatch_startable = false;
+std::atomic<bool> g_dispatch_started(false);
+
 void RunTaskRunner(TaskRunner::ID id) {
+  g_current_id = id;
   g_task_runners[id]->Run();
 }
 
@@ -54,6 +68,11 @@ bool TaskRunner::CurrentlyOn(ID id) {
          g_task_runners[id]->RunsTasksInCurrentThread();
 }
 
+// static
+TaskRunner::ID TaskRunner::CurrentID() {
+  return g_current_id;
+}
+
 // static
 std::shared_ptr<TaskRunner> TaskRunner::GetTaskRunner(ID id) {
   if (id < THREAD_COUNT && id >= EVENT)
@@ -70,16 +89,108 @@ bool TaskRunner::PostDelayedTask(ID id, Callback callback, TimeDelta delay) {
   return g_task_runners[id]->PostDelayedTask(std::move(callback), delay);
 }
 
+bool TaskRunner::PostUrgentTask(ID id, Callback callback) {
+  assert(id >= EVENT && id < THREAD_COUNT && g_task_runners[id]);
+  return g_task_runners[id]->PostUrgentTask(std::move(callback));
+}
+
+bool TaskRunner::PostTasks(ID id, std::vector<Callback> callbacks) {
+  return PostDelayedTasks(id, std::move(callbacks), TimeDelta());
+}
+
+bool TaskRunner::PostDelayedTasks(ID id,
+                                  std::vector<Callback> callbacks,
+                                  TimeDelta delay) {
+  assert(id >= EVENT && id < THREAD_COUNT && g_task_runners[id]);
+  return g_task_runners[id]->PostDelayedTasks(std::move(callbacks), delay);
+}
+
+// static
+TaskRunnerMetrics TaskRunner::GetMetrics(ID id) {
+  assert(id >= EVENT && id < THREAD_COUNT && g_task_runners[id]);
+  TaskRunner* runner = g_task_runners[id].get();
+  std::lock_guard<std::mutex> lock(runner->incomming_tasks_lock_);
+  return runner->metrics_;
+}
+
+// static
+bool TaskRunner::OpenChannel(ID from, ID to, size_t capacity) {
+  assert(from >= EVENT && from < THREAD_COUNT);
+  assert(to >= EVENT && to < THREAD_COUNT && g_task_runners[to]);
+  assert(from != to);
+  std::unique_ptr<TaskChannel> channel(new TaskChannel(capacity));
+  TaskChannel* expected = nullptr;
+  if (!g_task_runners[to]->channels_[from].compare_exchange_strong(
+          expected, channel.get(), std::memory_order_release)) {
+    return false;
+  }
+  channel.release();
+  return true;
+}
+
+// static
+bool TaskRunner::PostChannelTask(ID from, ID to, Callback&& callback) {
+  assert(to >= EVENT && to < THREAD_COUNT && g_task_runners[to]);
+  assert(CurrentlyOn(from));
+  TaskRunner* runner = g_task_runners[to].get();
+  TaskChannel* channel =
+      runner->channels_[from].load(std::memory_order_acquire);
+  if (!channel || !channel->Push(std::move(callback)))
+    return false;
+  // Pairs with the fence in Run, see PostUrgentTask.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (runner->waiting_.load(std::memory_order_relaxed))
+    runner->event_.Signal();
+  return true;
+}
+
 // static
 void TaskRunner::RunAll(Callback&& init_op) {
   for (int i = 0; i < THREAD_COUNT; ++i)
     g_task_runners[i].reset(new TaskRunner);
+  {
+    std::lock_guard<std::mutex> lock(g_dispatch_threads_lock);
+    g_dispatch_startable = true;
+    g_dispatch_started.store(false);
+  }
   PostTask(EVENT, std::move(init_op));
 
-  std::thread io_thread(RunTaskRunner, IO);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < DISPATCH_FIRST; ++i) {
+    if (i != EVENT)
+      threads.emplace_back(RunTaskRunner, static_cast<ID>(i));
+  }
+
+  RunTaskRunner(EVENT);
+  for (std::thread& thread : threads)
+    thread.join();
 
-  g_task_runners[EVENT]->Run();
-  io_thread.join();
+  std::vector<std::thread> dispatch_threads;
+  {
+    std::lock_guard<std::mutex> lock(g_dispatch_threads_lock);
+    // Stopped, too late to start them now.
+    g_dispatch_startable = false;
+    dispatch_threads.swap(g_dispatch_threads);
+  }
+  for (std::thread& thread : dispatch_threads)
+    thread.join();
+}
+
+// static
+void TaskRunner::StartDispatchRunners() {
+  if (g_dispatch_started.load())
+    return;
+  std::lock_guard<std::mutex> lock(g_dispatch_threads_lock);
+  if (!g_dispatch_startable || g_dispatch_started.load())
+    return;
+  for (int i = DISPATCH_FIRST; i <= DISPATCH_LAST; ++i)
+    g_dispatch_threads.emplace_back(RunTaskRunner, static_cast<ID>(i));
+  g_dispatch_started.store(true);
+}
+
+// static
+bool TaskRunner::DispatchRunnersStarted() {
+  return g_dispatch_started.load();
 }
 
 // static
@@ -93,7 +204,15 @@ TaskRunner::TaskRunner()
     : incomming_tasks_(new TaskQueue),
       triage_tasks_(new TaskQueue),
       delayed_tasks_(new std::priority_queue<PendingTask>),
+      waiting_(false),
       keep_running_(true) {
+  for (int i = 0; i < THREAD_COUNT; ++i)
+    channels_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+TaskRunner::~TaskRunner() {
+  for (int i = 0; i < THREAD_COUNT; ++i)
+    delete channels_[i].load(std::memory_order_acquire);
 }
 
 void TaskRunner::BindToCurrentThread() {
@@ -105,7 +224,20 @@ void TaskRunner::Run() {
   BindToCurrentThread();
   
   while (keep_running_) {
-    bool did_work = DoWork();
+    bool did_work = DoUrgentWork();
+    if (!keep_running_)
+      break;
+
+    did_work |= DoWork();
+    if (!keep_running_)
+      break;
+
+    did_work |= DoChannelWork();
+    if (!keep_running_)
+      break;
+
+    // The delayed task doesn't wait behind urgent ones either.
+    did_work |= DoUrgentWork();
     if (!keep_running_)
       break;
 
@@ -115,11 +247,18 @@ void TaskRunner::Run() {
     if (did_work)
       continue;
 
-    if (delayed_work_time_.is_null()) {
-      event_.Wait();
-    } else {
-      event_.TimedWaitUntil(delayed_work_time_);
+    // Pairs with the fence in PostUrgentTask and PostChannelTask, either the
+    // poster sees the runner waiting or the runner sees the task.
+    waiting_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (LockFreeLanesEmpty()) {
+      if (delayed_work_time_.is_null()) {
+        event_.Wait();
+      } else {
+        event_.TimedWaitUntil(delayed_work_time_);
+      }
     }
+    waiting_.store(false, std::memory_order_relaxed);
   }
 }
 
@@ -177,6 +316,45 @@ bool TaskRunner::DoDelayedWork() {
   return false;
 }
 
+bool TaskRunner::DoChannelWork() {
+  bool did_work = false;
+  for (int i = 0; i < THREAD_COUNT; ++i) {
+    TaskChannel* channel = channels_[i].load(std::memory_order_acquire);
+    if (!channel)
+      continue;
+    for (int n = 0; n < kMaxChannelTasksPerPoll; ++n) {
+      // Urgent tasks posted meanwhile run before the next channel task.
+      did_work |= DoUrgentWork();
+      if (!keep_running_ ||
+          !channel->Consume([](Callback&& task) { task.Run(); })) {
+        break;
+      }
+      did_work = true;
+    }
+  }
+  return did_work;
+}
+
+bool TaskRunner::DoUrgentWork() {
+  bool did_work = false;
+  while (keep_running_ &&
+         urgent_tasks_.Consume([](Callback&& task) { task.Run(); })) {
+    did_work = true;
+  }
+  return did_work;
+}
+
+bool TaskRunner::LockFreeLanesEmpty() {
+  if (!urgent_tasks_.Empty())
+    return false;
+  for (int i = 0; i < THREAD_COUNT; ++i) {
+    TaskChannel* channel = channels_[i].load(std::memory_order_acquire);
+    if (channel && !channel->Empty())
+      return false;
+  }
+  return true;
+}
+
 void TaskRunner::ReloadTriageTasksIfEmpty() {
   if (triage_tasks_->empty()) {
     std::lock_guard<std::mutex> lock(incomming_tasks_lock_);
@@ -185,16 +363,52 @@ void TaskRunner::ReloadTriageTasksIfEmpty() {
 }
 
 bool TaskRunner::PostDelayedTask(Callback callback, TimeDelta delay) {
-  PendingTask task(std::move(callback),
-                   next_sequence_num_++, ToTimeTicks(delay));
+  TimeTicks run_time = ToTimeTicks(delay);
   {
     std::lock_guard<std::mutex> lock(incomming_tasks_lock_);
     if (keep_running_) {
-      incomming_tasks_->push(std::move(task));
+      incomming_tasks_->push(
+          PendingTask(std::move(callback), next_sequence_num_++, run_time));
+      RecordBatch(1);
       event_.Signal();
     }
   }
   return true;
 }
 
+bool TaskRunner::PostDelayedTasks(std::vector<Callback> callbacks,
+                                  TimeDelta delay) {
+  if (callbacks.empty())
+    return true;
+
+  TimeTicks run_time = ToTimeTicks(delay);
+  {
+    std::lock_guard<std::mutex> lock(incomming_tasks_lock_);
+    if (keep_running_) {
+      for (auto& callback : callbacks) {
+        incomming_tasks_->push(
+            PendingTask(std::move(callback), next_sequence_num_++, run_time));
+      }
+      RecordBatch(callbacks.size());
+      event_.Signal();
+    }
+  }
+  return true;
+}
+
+bool TaskRunner::PostUrgentTask(Callback callback) {
+  urgent_tasks_.Push(std::move(callback));
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (waiting_.load(std::memory_order_relaxed))
+    event_.Signal();
+  return true;
+}
+
+void TaskRunner::RecordBatch(size_t size) {
+  metrics_.posted_tasks += size;
+  ++metrics_.posted_batches;
+  if (size > metrics_.max_batch_size)
+    metrics_.max_batch_size = size;
+}
+
 } // namespace cherry
\ No newline at end of file
@@ -2,24 +2,43 @@
 #define CHERRY_TASK_RUNNER_H_
 
 #include "cherry/callback.h"
+#include "cherry/mpsc_queue.h"
+#include "cherry/spsc_queue.h"
 #include "cherry/time.h"
 #include "cherry/waitable_event.h"
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
 namespace cherry {
 
 struct PendingTask;
 
 using TaskQueue = std::queue<PendingTask>;
+using TaskChannel = SpscQueue<Callback>;
+
+// Counters of a task runner, snapshot by TaskRunner::GetMetrics().
+struct TaskRunnerMetrics {
+  // Number of tasks posted.
+  uint64_t posted_tasks = 0;
+  // Number of posting operations, a batch posted by PostTasks counts once.
+  uint64_t posted_batches = 0;
+  // Size of the biggest batch.
+  uint64_t max_batch_size = 0;
+};
 
 // Class TaskRunner -----------------------------------------------------------
 class TaskRunner {
 public:
   using ThreadID = std::thread::id;
+
+  // Number of threads dispatching sharded events.
+  static const int kDispatchShardCount = 4;
+
   enum ID {
     // Main thread
     EVENT,
@@ -27,11 +46,17 @@ public:
     // Thread processes IO, i.e. file, IPC and network.
     IO,
 
+    // Threads dispatching the events of EventBus::FireSharded by key, only
+    // started on demand, see StartDispatchRunners.
+    DISPATCH_FIRST,
+    DISPATCH_LAST = DISPATCH_FIRST + kDispatchShardCount - 1,
+
     // Number of well-known threads.
     THREAD_COUNT
   };
 
   TaskRunner();
+  ~TaskRunner();
 
   void BindToCurrentThread();
   void Run();
@@ -40,19 +65,64 @@ public:
   void Stop();
 
   static bool CurrentlyOn(ID id);
+  // ID of the runner bound to the current thread, THREAD_COUNT if none.
+  static ID CurrentID();
   static std::shared_ptr<TaskRunner> GetTaskRunner(ID id);
   static bool PostTask(ID id, Callback callback);
   static bool PostDelayedTask(ID id, Callback callback, TimeDelta delay);
+  // Posts all |callbacks| with a single lock and a single wakeup, tasks of the
+  // batch run in order.
+  static bool PostTasks(ID id, std::vector<Callback> callbacks);
+  static bool PostDelayedTasks(ID id,
+                               std::vector<Callback> callbacks,
+                               TimeDelta delay);
+  static TaskRunnerMetrics GetMetrics(ID id);
+
+  // Posts |callback| to the urgent lane of runner |id|, drained before each
+  // normal, channel or delayed task, so it runs ahead of the work already
+  // pending. Urgent tasks run in posting order. Posting is lock free, the
+  // runner is only signaled when it sleeps.
+  static bool PostUrgentTask(ID id, Callback callback);
+
+  // Opens a dedicated single producer single consumer channel carrying tasks
+  // from runner |from| to runner |to|, bypassing the shared incomming queue.
+  // Must be called after RunAll has created the runners. Returns false if the
+  // channel is already open.
+  static bool OpenChannel(ID from, ID to, size_t capacity);
+  // Posts |callback| through the channel from |from| to |to|, must be called
+  // on |from|. Tasks of a channel run in posting order. Returns false if the
+  // channel is not open or is full, |callback| is left untouched then so the
+  // caller may fall back to PostTask. Like PostUrgentTask the runner is only
+  // signaled when it sleeps.
+  static bool PostChannelTask(ID from, ID to, Callback&& callback);
+  // Creates all the runners and runs EVENT, on the calling thread, and IO
+  // until StopAll. The dispatch runners are created but not started.
   static void RunAll(Callback&& init_op);
   static void StopAll();
 
+  // Starts the dispatch runner threads unless they already run, so
+  // applications which don't shard or isolate subscribers don't pay for
+  // them. Tasks posted to them before run once started. Can be called from
+  // any thread while RunAll runs, RunAll joins them when stopped.
+  static void StartDispatchRunners();
+  static bool DispatchRunnersStarted();
+
 private:
   bool DoWork();
   bool DoDelayedWork();
+  bool DoChannelWork();
+  bool DoUrgentWork();
+  // Returns true if no urgent or channel task is pending.
+  bool LockFreeLanesEmpty();
 
   void ReloadTriageTasksIfEmpty();
   
   bool PostDelayedTask(Callback callback, TimeDelta delay);
+  bool PostDelayedTasks(std::vector<Callback> callbacks, TimeDelta delay);
+  bool PostUrgentTask(Callback callback);
+
+  // Requires |incomming_tasks_lock_|.
+  void RecordBatch(size_t size);
 
   // The queue receiving all posted tasks.
   std::unique_ptr<TaskQueue> incomming_tasks_;
@@ -70,13 +140,24 @@ private:
   // Data lock
   std::mutex incomming_tasks_lock_;
 
+  // Guarded by |incomming_tasks_lock_|.
+  TaskRunnerMetrics metrics_;
+
   // The time to call DoDelayedWork.
   TimeTicks delayed_work_time_;
   // A recent snapshot of Time::Now(), used to check delayed_tasks_.
   TimeTicks recent_time_;
 
+  // Channels opened towards this runner, indexed by producer runner.
+  std::atomic<TaskChannel*> channels_[THREAD_COUNT];
+
+  MpscQueue<Callback> urgent_tasks_;
+
   // Used to sleep until there is more work to do.
   WaitableEvent event_;
+  // Set while the runner is about to wait on |event_|, urgent and channel
+  // tasks only signal it then.
+  std::atomic<bool> waiting_;
 
   bool keep_running_;
 
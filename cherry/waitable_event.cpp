@@ -10,24 +10,32 @@ namespace cherry {
 // Class WaitableEvent --------------------------------------------------------
 
 void WaitableEvent::Signal() {
+  {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    signaled_ = true;
+  }
   cv_.notify_one();
 }
 
 void WaitableEvent::Wait() {
   std::unique_lock<std::mutex> lock(wait_mutex_);
-  cv_.wait(lock);
+  cv_.wait(lock, [this] { return signaled_; });
+  signaled_ = false;
 }
 
 bool WaitableEvent::TimedWait(const TimeDelta& wait_delta) {
   microseconds ticks(wait_delta.Microseconds());
   std::unique_lock<std::mutex> lock(wait_mutex_);
-  std::cv_status status = cv_.wait_for(lock, ticks);
-  return status == std::cv_status::no_timeout;
+  bool signaled = cv_.wait_for(lock, ticks, [this] { return signaled_; });
+  signaled_ = false;
+  return signaled;
 }
 
 bool WaitableEvent::TimedWaitUntil(const TimeTicks& end_time) {
+  // |end_time| may already have passed while the caller was working.
   TimeDelta delta = end_time - TimeTicks::Now();
-  assert(delta.Microseconds() > 0);
+  if (delta < TimeDelta())
+    delta = TimeDelta();
   return TimedWait(delta);
 }
 
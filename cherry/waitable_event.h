@@ -8,6 +8,9 @@
 
 namespace cherry {
 
+// Auto reset event. A Signal() that happens while nobody waits is remembered
+// and consumed by the next wait, so a wakeup can't get lost between checking
+// for work and starting to wait.
 class WaitableEvent {
 public:
   WaitableEvent() = default;
@@ -20,6 +23,8 @@ public:
 private:
   std::condition_variable cv_;
   std::mutex wait_mutex_;
+  // Guarded by |wait_mutex_|.
+  bool signaled_ = false;
 
 };
 
@@ -54,7 +54,7 @@ public:
   void Test(int x, int y) {
     std::cout << TimeTicks::Now().Microseconds();
     std::cout << " Test, post to Test2" << std::endl;
-    EventBus::FireEvent(new TestEvent2(3.2f, 1));
+    EventBus::Emit<TestEvent2>(3.2f, 1);
 
     ++count_;
   }
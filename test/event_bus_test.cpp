@@ -0,0 +1,1202 @@
+#include "test/test.h"
+
+#include "cherry/event_macro.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+EVENT_DEFINE1(TestValueEvent, int)
+EVENT_DEFINE2(TestPairEvent, std::string, int)
+EVENT_DEFINE1(TestSharedEvent, std::shared_ptr<int>)
+EVENT_DEFINE_COALESCED_BY_KEY(TestStateEvent, int, int)
+EVENT_DEFINE_COALESCED(TestCountEvent, int)
+EVENT_DEFINE_RPC(TestDoubleCall, (int), (int))
+EVENT_DEFINE_STICKY(TestModeEvent, int)
+EVENT_DEFINE_STICKY_BY_KEY(TestLevelEvent, int, int)
+// Only fired by the metrics test, counters outlive the bus.
+EVENT_DEFINE1(TestMeteredEvent, int)
+
+
+namespace cherry {
+namespace test {
+namespace {
+
+// Event IDs are compile time constants derived from the event name.
+static_assert(TestValueEvent::ID ==
+                  HashEventName("TestValueEvent", Cherry_EventStart),
+              "EVENT_ID hashes the event name");
+static_assert(static_cast<int>(TestValueEvent::ID) !=
+                  static_cast<int>(TestPairEvent::ID),
+              "Events of different names get different IDs");
+
+TEST(EventBus, EventNamesAreRegistered) {
+  EXPECT_EQ(std::string("TestValueEvent"),
+            GetEventName(TestValueEvent::Slot()));
+  EXPECT_EQ(std::string("TestPairEvent"), GetEventName(TestPairEvent::Slot()));
+  // Registering a type again is harmless.
+  EXPECT_EQ(TestValueEvent::Slot(),
+            RegisterEvent(TestValueEvent::ID, "TestValueEvent",
+                          TestValueEvent::TypeTag()));
+  // Each type has its own tag.
+  EXPECT_TRUE(TestValueEvent::TypeTag() != TestPairEvent::TypeTag());
+  EXPECT_TRUE(GetEventName(kUnknownEventSlot) == nullptr);
+}
+
+// Class ValueSink ------------------------------------------------------------
+// Records the values it handles.
+class ValueSink {
+public:
+  void OnValue(int value) { values_.push_back(value); }
+
+  const std::vector<int>& values() const { return values_; }
+
+private:
+  std::vector<int> values_;
+
+};
+
+TEST(EventBus, StaleUnsubscribeKeepsNewSubscriber) {
+  ValueSink first;
+  ValueSink second;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&first, &second, &handle]() {
+    SubscriptionHandle stale =
+        EventBus::Subscribe<TestValueEvent>(&first, &ValueSink::OnValue);
+    EventBus::Unsubscribe(stale);
+    // Reuses the entry of |stale|.
+    handle = EventBus::Subscribe<TestValueEvent>(&second, &ValueSink::OnValue);
+    EXPECT_TRUE(handle != stale);
+    EventBus::Unsubscribe(stale);
+  });
+  EventBus::Emit<TestValueEvent>(1);
+  Drain(TaskRunner::EVENT);
+
+  EXPECT_EQ(0u, first.values().size());
+  EXPECT_EQ(1u, second.values().size());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, StaleUnsubscribeSurvivesManyReuses) {
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    SubscriptionHandle stale =
+        EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue);
+    EventBus::Unsubscribe(stale);
+    // The entry is reused 1024 times in all, which wraps any generation
+    // counter of up to 10 bits back to the one of |stale|.
+    for (int i = 0; i < 1023; ++i) {
+      EventBus::Unsubscribe(
+          EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue));
+    }
+    handle = EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue);
+    EventBus::Unsubscribe(stale);
+  });
+  EventBus::Emit<TestValueEvent>(1);
+  Drain(TaskRunner::EVENT);
+
+  EXPECT_EQ(1u, sink.values().size());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, SubscribeFailsPastMaxEventSlots) {
+  RunOn(TaskRunner::EVENT, []() {
+    SubscriptionHandle handle = EventBus::SubscribeHandler(
+        EventBus::kMaxEventSlots, [](const Event*) {});
+    EXPECT_EQ(kInvalidSubscription, handle);
+    // Unsubscribing the failed subscription is a no-op.
+    EventBus::Unsubscribe(handle);
+  });
+}
+
+// Class ValueObserver --------------------------------------------------------
+// Register'ed observer recording TestValueEvent, which it leaves unhandled.
+class ValueObserver : public EventObserver {
+public:
+  bool OnEvent(const Event* event) override {
+    if (event->GetID() == TestValueEvent::ID) {
+      const TestValueEvent* value = static_cast<const TestValueEvent*>(event);
+      values_.push_back(std::get<0>(value->param()));
+    }
+    return false;
+  }
+
+  const std::vector<int>& values() const { return values_; }
+
+private:
+  std::vector<int> values_;
+
+};
+
+TEST(EventBus, FirstWinsUnlessBroadcast) {
+  ValueObserver observer;
+  ValueSink first;
+  ValueSink second;
+  ValueSink io_sink;
+  std::vector<SubscriptionHandle> handles;
+  SubscriptionHandle io_handle = kInvalidSubscription;
+  EventBus::Register(&observer);
+  RunOn(TaskRunner::EVENT, [&first, &second, &handles]() {
+    handles.push_back(
+        EventBus::Subscribe<TestValueEvent>(&first, &ValueSink::OnValue));
+    handles.push_back(
+        EventBus::Subscribe<TestValueEvent>(&second, &ValueSink::OnValue));
+  });
+  RunOn(TaskRunner::IO, [&io_sink, &io_handle]() {
+    io_handle =
+        EventBus::Subscribe<TestValueEvent>(&io_sink, &ValueSink::OnValue);
+  });
+  EventBus::Emit<TestValueEvent>(1);
+  EventBus::Broadcast(new TestValueEvent(2));
+  Drain(TaskRunner::EVENT);
+  Drain(TaskRunner::IO);
+
+  EXPECT_EQ(2u, first.values().size());
+  ASSERT_TRUE(second.values().size() == 1);
+  EXPECT_EQ(2, second.values()[0]);
+  EXPECT_EQ(2u, io_sink.values().size());
+  // Handled by a subscriber, but broadcast.
+  ASSERT_TRUE(observer.values().size() == 1);
+  EXPECT_EQ(2, observer.values()[0]);
+  EventBus::Unregister(&observer);
+  RunOn(TaskRunner::EVENT, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+  RunOn(TaskRunner::IO, [io_handle]() { EventBus::Unsubscribe(io_handle); });
+}
+
+// Class NullObserver ---------------------------------------------------------
+// Handles nothing.
+class NullObserver : public EventObserver {
+public:
+  bool OnEvent(const Event*) override { return false; }
+};
+
+// Class GrowingSink ----------------------------------------------------------
+// Subscribes to many new event IDs from its handler, which grows the
+// registry of EVENT while the event is dispatched.
+class GrowingSink : public ValueSink {
+public:
+  void OnValue(int value) {
+    ValueSink::OnValue(value);
+    for (int i = 0; i < kNewEventIds; ++i)
+      handles_.push_back(EventBus::Subscribe(&observer_, kFirstNewId + i));
+  }
+
+  void UnsubscribeAll() {
+    for (SubscriptionHandle handle : handles_)
+      EventBus::Unsubscribe(handle);
+  }
+
+private:
+  static const int kNewEventIds = 200;
+  static const int kFirstNewId = 0x7e570000;
+
+  NullObserver observer_;
+  std::vector<SubscriptionHandle> handles_;
+
+};
+
+TEST(EventBus, SubscribeFromHandlerDuringBroadcast) {
+  GrowingSink growing;
+  ValueSink sink;
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&growing, &sink, &handles]() {
+    handles.push_back(
+        EventBus::Subscribe<TestValueEvent>(&growing, &GrowingSink::OnValue));
+    handles.push_back(
+        EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue));
+  });
+  EventBus::Broadcast(new TestValueEvent(1));
+  Drain(TaskRunner::EVENT);
+
+  EXPECT_EQ(1u, growing.values().size());
+  EXPECT_EQ(1u, sink.values().size());
+  RunOn(TaskRunner::EVENT, [&growing, &handles]() {
+    growing.UnsubscribeAll();
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+}
+
+// First wins holds per runner, the observers of EVENT get the events handled
+// by the subscriber of IO.
+TEST(EventBus, ObserverGetsEventsHandledOnOtherRunners) {
+  ValueObserver observer;
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  EventBus::Register(&observer);
+  RunOn(TaskRunner::IO, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue);
+  });
+  for (int i = 0; i < 3; ++i)
+    EventBus::Emit<TestValueEvent>(i);
+  Drain(TaskRunner::EVENT);
+  Drain(TaskRunner::IO);
+
+  EXPECT_EQ(3u, sink.values().size());
+  EXPECT_EQ(3u, observer.values().size());
+  EventBus::Unregister(&observer);
+  RunOn(TaskRunner::IO, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, ObserversComeAfterEventSubscribers) {
+  ValueObserver observer;
+  ValueSink event_sink;
+  ValueSink io_sink;
+  SubscriptionHandle event_handle = kInvalidSubscription;
+  SubscriptionHandle io_handle = kInvalidSubscription;
+  EventBus::Register(&observer);
+  RunOn(TaskRunner::EVENT, [&event_sink, &event_handle]() {
+    event_handle =
+        EventBus::Subscribe<TestValueEvent>(&event_sink, &ValueSink::OnValue);
+  });
+  RunOn(TaskRunner::IO, [&io_sink, &io_handle]() {
+    io_handle =
+        EventBus::Subscribe<TestValueEvent>(&io_sink, &ValueSink::OnValue);
+  });
+  EventBus::Emit<TestValueEvent>(1);
+  Drain(TaskRunner::EVENT);
+  Drain(TaskRunner::IO);
+
+  // The subscriber of EVENT handles the event first.
+  EXPECT_EQ(1u, event_sink.values().size());
+  EXPECT_EQ(1u, io_sink.values().size());
+  EXPECT_EQ(0u, observer.values().size());
+  EventBus::Unregister(&observer);
+  RunOn(TaskRunner::EVENT, [event_handle]() {
+    EventBus::Unsubscribe(event_handle);
+  });
+  RunOn(TaskRunner::IO, [io_handle]() { EventBus::Unsubscribe(io_handle); });
+}
+
+// Class PairSink -------------------------------------------------------------
+class PairSink {
+public:
+  void OnPair(const std::string& text, int value) {
+    text_ = text;
+    value_ = value;
+  }
+
+  const std::string& text() const { return text_; }
+  int value() const { return value_; }
+
+private:
+  std::string text_;
+  int value_ = 0;
+
+};
+
+TEST(EventBus, EmitConstructsEventInPlace) {
+  PairSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestPairEvent>(&sink, &PairSink::OnPair);
+  });
+  EventBus::Emit<TestPairEvent>("pooled", 7);
+  Drain(TaskRunner::EVENT);
+
+  EXPECT_EQ(std::string("pooled"), sink.text());
+  EXPECT_EQ(7, sink.value());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+// Class TextSink -------------------------------------------------------------
+// Takes the text by value, so it is moved out of a consumable event.
+class TextSink {
+public:
+  void OnPair(std::string text, int) { texts_.push_back(text); }
+
+  const std::vector<std::string>& texts() const { return texts_; }
+
+private:
+  std::vector<std::string> texts_;
+
+};
+
+// Class TextObserver ---------------------------------------------------------
+// Handles TestPairEvent through its event map but leaves it unhandled.
+class TextObserver : public TextSink, public EventObserver {
+public:
+  bool OnEvent(const Event* event) override {
+    BEGIN_EVENT_MAP(TextObserver, event)
+      EVENT_HANDLER(TestPairEvent, OnPair)
+    END_EVENT_MAP()
+    return false;
+  }
+};
+
+TEST(EventBus, EarlierSubscriberNeverTakesParameters) {
+  TextObserver observer;
+  TextSink sink;
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&observer, &sink, &handles]() {
+    handles.push_back(EventBus::Subscribe(&observer, TestPairEvent::ID));
+    handles.push_back(
+        EventBus::Subscribe<TestPairEvent>(&sink, &TextSink::OnPair));
+  });
+  EventBus::Emit<TestPairEvent>("kept", 1);
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(observer.texts().size() == 1);
+  EXPECT_EQ(std::string("kept"), observer.texts()[0]);
+  ASSERT_TRUE(sink.texts().size() == 1);
+  EXPECT_EQ(std::string("kept"), sink.texts()[0]);
+  RunOn(TaskRunner::EVENT, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+}
+
+// Class SharedSink -----------------------------------------------------------
+// Records the use count of the pointers it gets, 1 if moved out of the event.
+class SharedSink {
+public:
+  void OnShared(std::shared_ptr<int> value) {
+    use_counts_.push_back(value.use_count());
+  }
+
+  const std::vector<long>& use_counts() const { return use_counts_; }
+
+private:
+  std::vector<long> use_counts_;
+
+};
+
+TEST(EventBus, LastConsumerTakesParameters) {
+  SharedSink sink;
+  NullObserver observer;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle =
+        EventBus::Subscribe<TestSharedEvent>(&sink, &SharedSink::OnShared);
+  });
+  EventBus::Emit<TestSharedEvent>(std::make_shared<int>(1));
+  Drain(TaskRunner::EVENT);
+  // The observer may get the event after the subscriber.
+  EventBus::Register(&observer);
+  EventBus::Emit<TestSharedEvent>(std::make_shared<int>(2));
+  Drain(TaskRunner::EVENT);
+  TestSharedEvent* event = new TestSharedEvent(std::make_shared<int>(3));
+  EventBus::Broadcast(event);
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(sink.use_counts().size() == 3);
+  EXPECT_EQ(1, sink.use_counts()[0]);
+  EXPECT_EQ(2, sink.use_counts()[1]);
+  EXPECT_EQ(2, sink.use_counts()[2]);
+  EventBus::Unregister(&observer);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, LastRunnerTakesRoutedParameters) {
+  SharedSink event_sink;
+  SharedSink io_sink;
+  SubscriptionHandle event_handle = kInvalidSubscription;
+  SubscriptionHandle io_handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&event_sink, &event_handle]() {
+    event_handle = EventBus::Subscribe<TestSharedEvent>(
+        &event_sink, &SharedSink::OnShared);
+  });
+  RunOn(TaskRunner::IO, [&io_sink, &io_handle]() {
+    io_handle =
+        EventBus::Subscribe<TestSharedEvent>(&io_sink, &SharedSink::OnShared);
+  });
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  EventBus::Emit<TestSharedEvent>(std::make_shared<int>(1));
+  Drain(TaskRunner::EVENT);
+  gate.Open();
+  Drain(TaskRunner::IO);
+
+  // IO has yet to read the event when EVENT dispatches it.
+  ASSERT_TRUE(event_sink.use_counts().size() == 1);
+  EXPECT_EQ(2, event_sink.use_counts()[0]);
+  ASSERT_TRUE(io_sink.use_counts().size() == 1);
+  EXPECT_EQ(1, io_sink.use_counts()[0]);
+  RunOn(TaskRunner::EVENT, [event_handle]() {
+    EventBus::Unsubscribe(event_handle);
+  });
+  RunOn(TaskRunner::IO, [io_handle]() { EventBus::Unsubscribe(io_handle); });
+}
+
+// Class StateSink ------------------------------------------------------------
+class StateSink {
+public:
+  void OnState(int key, int value) {
+    keys_.push_back(key);
+    values_.push_back(value);
+  }
+
+  const std::vector<int>& keys() const { return keys_; }
+  const std::vector<int>& values() const { return values_; }
+
+private:
+  std::vector<int> keys_;
+  std::vector<int> values_;
+
+};
+
+TEST(EventBus, CoalescesPendingEventsByKey) {
+  StateSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestStateEvent>(&sink, &StateSink::OnState);
+  });
+  Gate gate;
+  gate.Hold(TaskRunner::EVENT);
+  EventBus::Emit<TestStateEvent>(1, 10);
+  EventBus::Emit<TestStateEvent>(2, 20);
+  EventBus::Emit<TestStateEvent>(1, 11);
+  EventBus::Emit<TestStateEvent>(1, 12);
+  gate.Open();
+  Drain(TaskRunner::EVENT);
+  // Dispatched, so the next one is queued again.
+  EventBus::Emit<TestStateEvent>(1, 13);
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(sink.keys().size() == 3);
+  EXPECT_EQ(1, sink.keys()[0]);
+  EXPECT_EQ(12, sink.values()[0]);
+  EXPECT_EQ(2, sink.keys()[1]);
+  EXPECT_EQ(20, sink.values()[1]);
+  EXPECT_EQ(13, sink.values()[2]);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+void AddCounts(std::tuple<int>* pending, std::tuple<int>&& incoming) {
+  std::get<0>(*pending) += std::get<0>(incoming);
+}
+
+TEST(EventBus, CoalescedEventsUseMergeFunction) {
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestCountEvent>(&sink, &ValueSink::OnValue);
+  });
+  TestCountEvent::SetMergeFunction(&AddCounts);
+  Gate gate;
+  gate.Hold(TaskRunner::EVENT);
+  for (int i = 1; i <= 4; ++i)
+    EventBus::Emit<TestCountEvent>(i);
+  gate.Open();
+  Drain(TaskRunner::EVENT);
+  TestCountEvent::SetMergeFunction(nullptr);
+
+  ASSERT_TRUE(sink.values().size() == 1);
+  EXPECT_EQ(10, sink.values()[0]);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, FireEventNowDispatchesOnEventOnly) {
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue);
+    EXPECT_TRUE(EventBus::FireEventNow(new TestValueEvent(1)));
+    EXPECT_EQ(1u, sink.values().size());
+  });
+  // Queued when fired off EVENT.
+  EXPECT_FALSE(EventBus::FireEventNow(new TestValueEvent(2)));
+  Drain(TaskRunner::EVENT);
+
+  EXPECT_EQ(2u, sink.values().size());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+// Class NestingSink ----------------------------------------------------------
+// Fires the next value inline from its handler, up to 10.
+class NestingSink : public ValueSink {
+public:
+  void OnValue(int value) {
+    ValueSink::OnValue(value);
+    if (value == 10)
+      return;
+    TestValueEvent* next = new TestValueEvent(value + 1);
+    if (!EventBus::FireEventNow(next))
+      ++queued_;
+  }
+
+  int queued() const { return queued_; }
+
+private:
+  int queued_ = 0;
+
+};
+
+TEST(EventBus, FireEventNowQueuesPastMaxDepth) {
+  NestingSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle =
+        EventBus::Subscribe<TestValueEvent>(&sink, &NestingSink::OnValue);
+    EXPECT_TRUE(EventBus::FireEventNow(new TestValueEvent(0)));
+    EXPECT_EQ(static_cast<size_t>(EventBus::kMaxDispatchDepth),
+              sink.values().size());
+  });
+  Drain(TaskRunner::EVENT);
+
+  // The queued event starts over at the outermost level.
+  EXPECT_EQ(1, sink.queued());
+  ASSERT_TRUE(sink.values().size() == 11);
+  for (int i = 0; i <= 10; ++i)
+    EXPECT_EQ(i, sink.values()[i]);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, RegisterFromManyThreads) {
+  const int kThreads = 4;
+  const int kPerThread = 8;
+  std::vector<ValueObserver> observers(kThreads * kPerThread);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&observers, t]() {
+      for (int i = 0; i < kPerThread; ++i)
+        EventBus::Register(&observers[t * kPerThread + i]);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  EventBus::Emit<TestValueEvent>(1);
+  Drain(TaskRunner::EVENT);
+  threads.clear();
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&observers, t]() {
+      for (int i = 0; i < kPerThread; ++i)
+        EventBus::Unregister(&observers[t * kPerThread + i]);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  EventBus::Emit<TestValueEvent>(2);
+  Drain(TaskRunner::EVENT);
+
+  for (const ValueObserver& observer : observers) {
+    ASSERT_TRUE(observer.values().size() == 1);
+    EXPECT_EQ(1, observer.values()[0]);
+  }
+}
+
+// Class SlowObserver ---------------------------------------------------------
+// Takes a while to handle an event.
+class SlowObserver : public EventObserver {
+public:
+  bool OnEvent(const Event*) override {
+    entered_ = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    left_ = true;
+    return false;
+  }
+
+  bool entered() const { return entered_; }
+  bool left() const { return left_; }
+
+private:
+  std::atomic<bool> entered_{false};
+  std::atomic<bool> left_{false};
+
+};
+
+TEST(EventBus, UnregisterWaitsForRunningObserver) {
+  SlowObserver observer;
+  EventBus::Register(&observer);
+  EventBus::Emit<TestValueEvent>(1);
+  EXPECT_TRUE(WaitFor([&observer]() { return observer.entered(); }));
+  EventBus::Unregister(&observer);
+
+  // The observer could be deleted now.
+  EXPECT_TRUE(observer.left());
+  Drain(TaskRunner::EVENT);
+}
+
+TEST(EventBus, KeyedSubscribersGetTheirKeyFirst) {
+  TextSink a_sink;
+  TextSink b_sink;
+  TextSink any_sink;
+  SubscriptionHandle a_handle = kInvalidSubscription;
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&]() {
+    a_handle = EventBus::Subscribe<TestPairEvent>(std::string("a"), &a_sink,
+                                                  &TextSink::OnPair);
+    handles.push_back(EventBus::Subscribe<TestPairEvent>(
+        std::string("b"), &b_sink, &TextSink::OnPair));
+    handles.push_back(
+        EventBus::Subscribe<TestPairEvent>(&any_sink, &TextSink::OnPair));
+  });
+  EventBus::Emit<TestPairEvent>("a", 1);
+  EventBus::Emit<TestPairEvent>("b", 2);
+  EventBus::Emit<TestPairEvent>("c", 3);
+  Drain(TaskRunner::EVENT);
+  RunOn(TaskRunner::EVENT, [a_handle]() { EventBus::Unsubscribe(a_handle); });
+  EventBus::Emit<TestPairEvent>("a", 4);
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(a_sink.texts().size() == 1);
+  EXPECT_EQ(std::string("a"), a_sink.texts()[0]);
+  ASSERT_TRUE(b_sink.texts().size() == 1);
+  EXPECT_EQ(std::string("b"), b_sink.texts()[0]);
+  // Events without keyed subscriber fall through to the others.
+  ASSERT_TRUE(any_sink.texts().size() == 2);
+  EXPECT_EQ(std::string("c"), any_sink.texts()[0]);
+  EXPECT_EQ(std::string("a"), any_sink.texts()[1]);
+  RunOn(TaskRunner::EVENT, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+}
+
+// Class ShardedSink ----------------------------------------------------------
+// Records the values of each key, called from several dispatch runners.
+class ShardedSink {
+public:
+  void OnPair(const std::string& key, int value) {
+    std::lock_guard<std::mutex> guard(lock_);
+    values_[key].push_back(value);
+    ++count_;
+  }
+
+  std::map<std::string, std::vector<int>> values() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return values_;
+  }
+
+  int count() const { return count_; }
+
+private:
+  std::mutex lock_;
+  std::map<std::string, std::vector<int>> values_;
+  std::atomic<int> count_{0};
+
+};
+
+TEST(EventBus, ShardedSubscriberKeepsKeyOrder) {
+  const int kKeys = 8;
+  const int kPerKey = 50;
+  ShardedSink sink;
+  // Nothing to dispatch on the dispatch runners yet.
+  EventBus::FireSharded(new TestPairEvent("none", 0));
+  EXPECT_FALSE(TaskRunner::DispatchRunnersStarted());
+  SubscriptionHandle handle = EventBus::Subscribe<TestPairEvent>(
+      EventBus::PER_KEY_ORDER, &sink, &ShardedSink::OnPair);
+  EXPECT_TRUE(TaskRunner::DispatchRunnersStarted());
+  for (int i = 0; i < kPerKey; ++i) {
+    for (int key = 0; key < kKeys; ++key)
+      EventBus::FireSharded(new TestPairEvent(std::to_string(key), i));
+  }
+  EXPECT_TRUE(WaitFor([&sink]() { return sink.count() == kKeys * kPerKey; }));
+
+  std::map<std::string, std::vector<int>> values = sink.values();
+  EXPECT_EQ(static_cast<size_t>(kKeys), values.size());
+  for (const auto& key_values : values) {
+    ASSERT_TRUE(key_values.second.size() == kPerKey);
+    for (int i = 0; i < kPerKey; ++i)
+      EXPECT_EQ(i, key_values.second[i]);
+  }
+  EventBus::Unsubscribe(handle);
+}
+
+TEST(EventBus, ShardedSubscriberCountsCallsOfAllShards) {
+  const int kEvents = 400;
+  ShardedSink sink;
+  SubscriptionHandle handle = EventBus::Subscribe<TestPairEvent>(
+      EventBus::PER_KEY_ORDER, &sink, &ShardedSink::OnPair);
+  EventBus::EnableMetrics(true);
+  for (int i = 0; i < kEvents; ++i)
+    EventBus::FireSharded(new TestPairEvent(std::to_string(i % 16), i));
+  // The shards share the counters of the subscriber.
+  EXPECT_TRUE(WaitFor([handle]() {
+    for (const SubscriberMetrics& subscriber :
+         EventBus::GetMetrics().subscribers) {
+      if (subscriber.handle == handle)
+        return subscriber.calls == kEvents;
+    }
+    return false;
+  }));
+  EventBus::EnableMetrics(false);
+  EventBus::Unsubscribe(handle);
+}
+
+TEST(EventBus, MetricsCountEventsAndSubscribers) {
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle =
+        EventBus::Subscribe<TestMeteredEvent>(&sink, &ValueSink::OnValue);
+  });
+  EventBus::EnableMetrics(true);
+  for (int i = 0; i < 3; ++i)
+    EventBus::Emit<TestMeteredEvent>(i);
+  Drain(TaskRunner::EVENT);
+  EventBus::EnableMetrics(false);
+  // Not counted.
+  EventBus::Emit<TestMeteredEvent>(3);
+  Drain(TaskRunner::EVENT);
+
+  EventBusMetrics metrics = EventBus::GetMetrics();
+  const EventMetrics* event = nullptr;
+  for (const EventMetrics& candidate : metrics.events) {
+    if (candidate.slot == TestMeteredEvent::Slot())
+      event = &candidate;
+  }
+  ASSERT_TRUE(event != nullptr);
+  EXPECT_EQ(std::string("TestMeteredEvent"), event->name);
+  EXPECT_EQ(3u, event->fired);
+  EXPECT_EQ(3u, event->dispatched);
+  EXPECT_EQ(0u, event->unhandled);
+  EXPECT_TRUE(event->max_queue_delay_ns <= event->queue_delay_ns);
+  const SubscriberMetrics* subscriber = nullptr;
+  for (const SubscriberMetrics& candidate : metrics.subscribers) {
+    if (candidate.handle == handle)
+      subscriber = &candidate;
+  }
+  ASSERT_TRUE(subscriber != nullptr);
+  EXPECT_EQ(TestMeteredEvent::Slot(), subscriber->slot);
+  EXPECT_EQ(3u, subscriber->calls);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+// Class PairBatchSink --------------------------------------------------------
+// Records the batches of TestPairEvent it handles.
+class PairBatchSink {
+public:
+  void OnPairs(const EventBatch<TestPairEvent>& pairs) {
+    sizes_.push_back(pairs.size());
+    texts_.insert(texts_.end(), pairs.column<0>().begin(),
+                  pairs.column<0>().end());
+  }
+
+  const std::vector<size_t>& sizes() const { return sizes_; }
+  const std::vector<std::string>& texts() const { return texts_; }
+
+private:
+  std::vector<size_t> sizes_;
+  std::vector<std::string> texts_;
+
+};
+
+TEST(EventBus, BatchedEventsReachOtherSubscribers) {
+  PairBatchSink batch_sink;
+  TextSink sink;
+  SubscriptionHandle batch_handle = kInvalidSubscription;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::IO, [&batch_sink, &batch_handle]() {
+    batch_handle = EventBus::SubscribeBatch<TestPairEvent>(
+        &batch_sink, &PairBatchSink::OnPairs);
+  });
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestPairEvent>(&sink, &TextSink::OnPair);
+  });
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  EventBus::Emit<TestPairEvent>("a", 1);
+  EventBus::FireEvent(new TestPairEvent("b", 2));
+  RunOn(TaskRunner::EVENT, []() {
+    EXPECT_TRUE(EventBus::FireEventNow(new TestPairEvent("c", 3)));
+  });
+  gate.Open();
+  Drain(TaskRunner::IO);
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(batch_sink.sizes().size() == 1);
+  EXPECT_EQ(3u, batch_sink.sizes()[0]);
+  ASSERT_TRUE(batch_sink.texts().size() == 3);
+  EXPECT_EQ(std::string("a"), batch_sink.texts()[0]);
+  EXPECT_EQ(std::string("c"), batch_sink.texts()[2]);
+  // The batch got copies, the subscriber still takes whole parameters.
+  ASSERT_TRUE(sink.texts().size() == 3);
+  EXPECT_EQ(std::string("a"), sink.texts()[0]);
+  EXPECT_EQ(std::string("b"), sink.texts()[1]);
+  EXPECT_EQ(std::string("c"), sink.texts()[2]);
+  RunOn(TaskRunner::IO,
+        [batch_handle]() { EventBus::Unsubscribe(batch_handle); });
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+// Class ModeBatchSink --------------------------------------------------------
+// Records the TestModeEvent batches it handles.
+class ModeBatchSink {
+public:
+  void OnModes(const EventBatch<TestModeEvent>& modes) {
+    modes_.insert(modes_.end(), modes.column<0>().begin(),
+                  modes.column<0>().end());
+  }
+
+  const std::vector<int>& modes() const { return modes_; }
+
+private:
+  std::vector<int> modes_;
+
+};
+
+TEST(EventBus, BatchesGetEventsHoweverFired) {
+  PairBatchSink pair_sink;
+  ModeBatchSink mode_sink;
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::IO, [&pair_sink, &mode_sink, &handles]() {
+    handles.push_back(EventBus::SubscribeBatch<TestPairEvent>(
+        &pair_sink, &PairBatchSink::OnPairs));
+    handles.push_back(EventBus::SubscribeBatch<TestModeEvent>(
+        &mode_sink, &ModeBatchSink::OnModes));
+  });
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  EventBus::Broadcast(new TestPairEvent("broadcast", 1));
+  EventBus::FireSharded(new TestPairEvent("sharded", 2));
+  EventBus::Emit<TestModeEvent>(3);
+  gate.Open();
+  Drain(TaskRunner::IO);
+
+  ASSERT_TRUE(pair_sink.texts().size() == 2);
+  EXPECT_EQ(std::string("broadcast"), pair_sink.texts()[0]);
+  EXPECT_EQ(std::string("sharded"), pair_sink.texts()[1]);
+  ASSERT_TRUE(mode_sink.modes().size() == 1);
+  EXPECT_EQ(3, mode_sink.modes()[0]);
+  RunOn(TaskRunner::IO, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+  EventBus::ClearSticky(TestModeEvent::ID);
+}
+
+// Class OrderLog -------------------------------------------------------------
+// Records the order TestPairEvent batches and TestValueEvent events come in.
+class OrderLog {
+public:
+  void OnPairs(const EventBatch<TestPairEvent>& pairs) {
+    entries_.push_back("pairs:" + std::to_string(pairs.size()));
+  }
+
+  void OnValue(int value) { entries_.push_back(std::to_string(value)); }
+
+  const std::vector<std::string>& entries() const { return entries_; }
+
+private:
+  std::vector<std::string> entries_;
+
+};
+
+TEST(EventBus, BatchAtLastIsHandledOnceOld) {
+  OrderLog log;
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&log, &handles]() {
+    handles.push_back(EventBus::SubscribeBatch<TestPairEvent>(
+        &log, &OrderLog::OnPairs, EventBus::BATCH_AT_LAST));
+    handles.push_back(
+        EventBus::Subscribe<TestValueEvent>(&log, &OrderLog::OnValue));
+  });
+  Gate gate;
+  gate.Hold(TaskRunner::EVENT);
+  EventBus::Emit<TestPairEvent>("a", 1);
+  EventBus::Emit<TestPairEvent>("b", 2);
+  std::this_thread::sleep_for(
+      std::chrono::nanoseconds(2 * EventBus::kMaxBatchDelayNs));
+  EventBus::Emit<TestValueEvent>(7);
+  // Would hold the batch back until after 7.
+  EventBus::Emit<TestPairEvent>("c", 3);
+  gate.Open();
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(log.entries().size() == 2);
+  EXPECT_EQ(std::string("pairs:3"), log.entries()[0]);
+  EXPECT_EQ(std::string("7"), log.entries()[1]);
+  RunOn(TaskRunner::EVENT, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+}
+
+// Class Doubler --------------------------------------------------------------
+class Doubler {
+public:
+  int OnDouble(int value) { return value * 2; }
+};
+
+TEST(EventBus, CallAsyncRepliesToChosenRunner) {
+  Doubler doubler;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&doubler, &handle]() {
+    handle = EventBus::Subscribe<TestDoubleCall>(&doubler,
+                                                 &Doubler::OnDouble);
+  });
+  std::atomic<int> result(0);
+  std::atomic<bool> on_io(false);
+  // The driver thread isn't a runner, it has the reply posted to IO.
+  EventBus::CallAsync<TestDoubleCall>(
+      TaskRunner::IO,
+      [&result, &on_io](bool replied, TestDoubleCall::Reply reply) {
+        on_io = TaskRunner::CurrentlyOn(TaskRunner::IO);
+        result = replied ? std::get<0>(reply) : -1;
+      },
+      21);
+  EXPECT_TRUE(WaitFor([&result]() { return result != 0; }));
+  EXPECT_EQ(42, result.load());
+  EXPECT_TRUE(on_io.load());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, CallAsyncRepliesToCallingRunner) {
+  Doubler doubler;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&doubler, &handle]() {
+    handle = EventBus::Subscribe<TestDoubleCall>(&doubler,
+                                                 &Doubler::OnDouble);
+  });
+  std::atomic<int> result(0);
+  std::atomic<bool> on_io(false);
+  RunOn(TaskRunner::IO, [&result, &on_io]() {
+    EventBus::CallAsync<TestDoubleCall>(
+        [&result, &on_io](bool replied, TestDoubleCall::Reply reply) {
+          on_io = TaskRunner::CurrentlyOn(TaskRunner::IO);
+          result = replied ? std::get<0>(reply) : -1;
+        },
+        5);
+  });
+  EXPECT_TRUE(WaitFor([&result]() { return result != 0; }));
+  EXPECT_EQ(10, result.load());
+  EXPECT_TRUE(on_io.load());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, CancelTokenDropsQueuedEvent) {
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue);
+  });
+  Gate gate;
+  gate.Hold(TaskRunner::EVENT);
+  CancelToken token = EventBus::FireCancelable(new TestValueEvent(1));
+  CancelToken kept = EventBus::FireCancelable(new TestValueEvent(2));
+  token.Cancel();
+  EXPECT_TRUE(token.IsCanceled());
+  EXPECT_FALSE(kept.IsCanceled());
+  gate.Open();
+  Drain(TaskRunner::EVENT);
+  // The event is gone, its token is still safe to use.
+  kept.Cancel();
+
+  ASSERT_TRUE(sink.values().size() == 1);
+  EXPECT_EQ(2, sink.values()[0]);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, CancelPendingKeyDropsOnlyEarlierEvents) {
+  ValueSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::IO, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestValueEvent>(&sink, &ValueSink::OnValue);
+  });
+  for (int round = 0; round < 2; ++round) {
+    Gate gate;
+    gate.Hold(TaskRunner::IO);
+    EventBus::Emit<TestValueEvent>(1);
+    EventBus::Emit<TestValueEvent>(2);
+    EventBus::CancelPending<TestValueEvent>(1);
+    EventBus::Emit<TestValueEvent>(1);
+    gate.Open();
+    Drain(TaskRunner::IO);
+    // Once forgotten the key is canceled again as if it never was.
+    Drain(TaskRunner::EVENT);
+  }
+
+  ASSERT_TRUE(sink.values().size() == 4);
+  for (int round = 0; round < 2; ++round) {
+    EXPECT_EQ(2, sink.values()[round * 2]);
+    EXPECT_EQ(1, sink.values()[round * 2 + 1]);
+  }
+  RunOn(TaskRunner::IO, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, IsolatedSubscriberGetsHandledEvents) {
+  ValueSink first;
+  ValueSink isolated;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&first, &handle]() {
+    handle = EventBus::Subscribe<TestValueEvent>(&first, &ValueSink::OnValue);
+  });
+  IsolationOptions options;
+  options.runner = TaskRunner::IO;
+  SubscriptionHandle isolated_handle = EventBus::SubscribeIsolated<
+      TestValueEvent>(&isolated, &ValueSink::OnValue, options);
+  EventBus::Emit<TestValueEvent>(1);
+  EventBus::Broadcast(new TestValueEvent(2));
+  Drain(TaskRunner::EVENT);
+  Drain(TaskRunner::IO);
+
+  // |first| handles the events before the isolated subscriber would get
+  // them from dispatch.
+  EXPECT_EQ(2u, first.values().size());
+  ASSERT_TRUE(isolated.values().size() == 2);
+  EXPECT_EQ(1, isolated.values()[0]);
+  EXPECT_EQ(2, isolated.values()[1]);
+  EventBus::Unsubscribe(isolated_handle);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+}
+
+TEST(EventBus, IsolatedSubscriberDropsCanceledEvents) {
+  ValueSink sink;
+  IsolationOptions options;
+  options.runner = TaskRunner::IO;
+  SubscriptionHandle handle = EventBus::SubscribeIsolated<TestValueEvent>(
+      &sink, &ValueSink::OnValue, options);
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  CancelToken token = EventBus::FireCancelable(new TestValueEvent(1));
+  EventBus::Emit<TestValueEvent>(2);
+  EventBus::Emit<TestValueEvent>(3);
+  // The events are queued for |sink| by now, canceling has to reach them.
+  Drain(TaskRunner::EVENT);
+  token.Cancel();
+  EventBus::CancelPending<TestValueEvent>(2);
+  gate.Open();
+  Drain(TaskRunner::IO);
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(sink.values().size() == 1);
+  EXPECT_EQ(3, sink.values()[0]);
+  EventBus::Unsubscribe(handle);
+}
+
+// Fires |values| at an isolated subscriber with a queue of 2 held on IO,
+// returns what it gets.
+std::vector<int> DeliverIsolated(IsolationOptions::Overflow overflow,
+                                 const std::vector<int>& values,
+                                 IsolatedMetrics* metrics) {
+  ValueSink sink;
+  IsolationOptions options;
+  options.capacity = 2;
+  options.overflow = overflow;
+  options.runner = TaskRunner::IO;
+  SubscriptionHandle handle = EventBus::SubscribeIsolated<TestValueEvent>(
+      &sink, &ValueSink::OnValue, options);
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  for (int value : values)
+    EventBus::Emit<TestValueEvent>(value);
+  gate.Open();
+  Drain(TaskRunner::IO);
+  for (const IsolatedMetrics& isolated : EventBus::GetMetrics().isolated) {
+    if (isolated.handle == handle)
+      *metrics = isolated;
+  }
+  EventBus::Unsubscribe(handle);
+  return sink.values();
+}
+
+TEST(EventBus, IsolatedQueueOverflow) {
+  IsolatedMetrics metrics;
+  std::vector<int> values =
+      DeliverIsolated(IsolationOptions::DROP_OLDEST, { 1, 2, 3, 4 }, &metrics);
+  EXPECT_TRUE(values == std::vector<int>({ 3, 4 }));
+  EXPECT_EQ(2u, metrics.dropped);
+
+  values =
+      DeliverIsolated(IsolationOptions::DROP_NEWEST, { 1, 2, 3, 4 }, &metrics);
+  EXPECT_TRUE(values == std::vector<int>({ 1, 2 }));
+  EXPECT_EQ(2u, metrics.dropped);
+
+  // The value is the key, 1 replaces itself in place.
+  values = DeliverIsolated(IsolationOptions::COALESCE, { 1, 2, 1 }, &metrics);
+  EXPECT_TRUE(values == std::vector<int>({ 1, 2 }));
+  EXPECT_EQ(1u, metrics.coalesced);
+  EXPECT_EQ(0u, metrics.dropped);
+}
+
+// Class LevelSink ------------------------------------------------------------
+// Records the TestLevelEvent values in order, and the last one by key.
+class LevelSink {
+public:
+  void OnLevel(int key, int level) {
+    levels_.push_back(level);
+    last_[key] = level;
+  }
+
+  const std::vector<int>& levels() const { return levels_; }
+  const std::map<int, int>& last() const { return last_; }
+
+private:
+  std::vector<int> levels_;
+  std::map<int, int> last_;
+
+};
+
+TEST(EventBus, StickyEventsReplayToLateSubscribers) {
+  EventBus::Emit<TestModeEvent>(1);
+  EventBus::Emit<TestModeEvent>(2);
+  EventBus::Emit<TestLevelEvent>(1, 10);
+  EventBus::Emit<TestLevelEvent>(2, 20);
+  EventBus::Emit<TestLevelEvent>(1, 11);
+  Drain(TaskRunner::EVENT);
+
+  ValueSink mode_sink;
+  LevelSink level_sink;
+  std::vector<SubscriptionHandle> handles;
+  RunOn(TaskRunner::EVENT, [&mode_sink, &level_sink, &handles]() {
+    handles.push_back(EventBus::Subscribe<TestModeEvent>(
+        &mode_sink, &ValueSink::OnValue));
+    handles.push_back(EventBus::Subscribe<TestLevelEvent>(
+        &level_sink, &LevelSink::OnLevel));
+  });
+  Drain(TaskRunner::EVENT);
+
+  // Only the last event, of each key when keyed, is kept.
+  ASSERT_TRUE(mode_sink.values().size() == 1);
+  EXPECT_EQ(2, mode_sink.values()[0]);
+  EXPECT_EQ(2u, level_sink.levels().size());
+  std::map<int, int> expected = { { 1, 11 }, { 2, 20 } };
+  EXPECT_TRUE(level_sink.last() == expected);
+
+  // Later events are dispatched as usual.
+  EventBus::Emit<TestLevelEvent>(2, 21);
+  Drain(TaskRunner::EVENT);
+  ASSERT_TRUE(level_sink.levels().size() == 3);
+  EXPECT_EQ(21, level_sink.levels()[2]);
+
+  // Cleared events aren't replayed.
+  EventBus::ClearSticky(TestModeEvent::ID);
+  ValueSink late_sink;
+  RunOn(TaskRunner::EVENT, [&late_sink, &handles]() {
+    handles.push_back(EventBus::Subscribe<TestModeEvent>(
+        &late_sink, &ValueSink::OnValue));
+  });
+  Drain(TaskRunner::EVENT);
+  EXPECT_EQ(0u, late_sink.values().size());
+  RunOn(TaskRunner::EVENT, [&handles]() {
+    for (SubscriptionHandle handle : handles)
+      EventBus::Unsubscribe(handle);
+  });
+}
+
+TEST(EventBus, FireEventLazyBuildsForObservers) {
+  int built = 0;
+  auto factory = [&built]() {
+    ++built;
+    return new TestValueEvent(built);
+  };
+  EXPECT_FALSE(EventBus::HasSubscribers<TestValueEvent>());
+  EXPECT_FALSE(EventBus::FireEventLazy<TestValueEvent>(factory));
+  EXPECT_EQ(0, built);
+
+  ValueObserver observer;
+  EventBus::Register(&observer);
+  EXPECT_TRUE(EventBus::HasSubscribers<TestValueEvent>());
+  EXPECT_TRUE(EventBus::FireEventLazy<TestValueEvent>(factory));
+  Drain(TaskRunner::EVENT);
+  EXPECT_EQ(1, built);
+  ASSERT_TRUE(observer.values().size() == 1);
+  EXPECT_EQ(1, observer.values()[0]);
+  EventBus::Unregister(&observer);
+  EXPECT_FALSE(EventBus::HasSubscribers<TestValueEvent>());
+}
+
+} // namespace
+} // namespace test
+} // namespace cherry
@@ -0,0 +1,121 @@
+#include "test/test.h"
+
+#include "cherry/event_journal.h"
+#include "cherry/event_macro.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+EVENT_DEFINE2(TestJournaledEvent, int, std::string)
+
+
+namespace cherry {
+namespace test {
+namespace {
+
+// Class JournaledSink --------------------------------------------------------
+// Handles the journaled events, so no later subscriber gets them.
+class JournaledSink {
+public:
+  void OnJournaled(int value, std::string text) {
+    values_.push_back(value);
+    texts_.push_back(text);
+  }
+
+  const std::vector<int>& values() const { return values_; }
+  const std::vector<std::string>& texts() const { return texts_; }
+
+private:
+  std::vector<int> values_;
+  std::vector<std::string> texts_;
+
+};
+
+void RemoveJournal(const std::string& directory) {
+  for (unsigned index = 0;; ++index) {
+    char name[32];
+    snprintf(name, sizeof(name), "/events.%06u.journal", index);
+    if (unlink((directory + name).c_str()) != 0)
+      break;
+  }
+  rmdir(directory.c_str());
+}
+
+TEST(EventJournal, RecordsEventsHandledFirstAndReplaysThem) {
+  std::string directory =
+      "/tmp/cherry_test_journal_" + std::to_string(getpid());
+  std::unique_ptr<EventJournal> journal = EventJournal::Create(directory, 0);
+  ASSERT_TRUE(journal != nullptr);
+  JournaledSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  // Subscribed before the journal records.
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestJournaledEvent>(
+        &sink, &JournaledSink::OnJournaled);
+  });
+  journal->Record<TestJournaledEvent>();
+  for (int i = 0; i < 3; ++i)
+    EventBus::Emit<TestJournaledEvent>(i, std::string(i + 1, 'x'));
+  Drain(TaskRunner::EVENT);
+  EXPECT_EQ(3u, journal->recorded());
+  EXPECT_EQ(0u, journal->dropped());
+  journal.reset();
+
+  JournalReplayer replayer(directory);
+  replayer.Replay<TestJournaledEvent>();
+  EXPECT_EQ(3u, replayer.Run(JournalReplayer::MAX_SPEED));
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(sink.values().size() == 6);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(i, sink.values()[3 + i]);
+    EXPECT_EQ(std::string(i + 1, 'x'), sink.texts()[3 + i]);
+  }
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+  RemoveJournal(directory);
+}
+
+TEST(EventJournal, CreateReplacesLongerJournal) {
+  std::string directory =
+      "/tmp/cherry_test_journal_long_" + std::to_string(getpid());
+  JournaledSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle]() {
+    handle = EventBus::Subscribe<TestJournaledEvent>(
+        &sink, &JournaledSink::OnJournaled);
+  });
+  // Fills several segments of the smallest size.
+  std::unique_ptr<EventJournal> journal = EventJournal::Create(directory, 0);
+  ASSERT_TRUE(journal != nullptr);
+  journal->Record<TestJournaledEvent>();
+  for (int i = 0; i < 20; ++i)
+    EventBus::Emit<TestJournaledEvent>(i, std::string(1000, 'x'));
+  Drain(TaskRunner::EVENT);
+  journal.reset();
+
+  journal = EventJournal::Create(directory, 0);
+  ASSERT_TRUE(journal != nullptr);
+  journal->Record<TestJournaledEvent>();
+  EventBus::Emit<TestJournaledEvent>(-1, std::string("new"));
+  Drain(TaskRunner::EVENT);
+  journal.reset();
+
+  JournalReplayer replayer(directory);
+  replayer.Replay<TestJournaledEvent>();
+  EXPECT_EQ(1u, replayer.Run(JournalReplayer::MAX_SPEED));
+  Drain(TaskRunner::EVENT);
+
+  ASSERT_TRUE(sink.values().size() == 22);
+  EXPECT_EQ(-1, sink.values()[21]);
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+  RemoveJournal(directory);
+}
+
+} // namespace
+} // namespace test
+} // namespace cherry
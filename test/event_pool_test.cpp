@@ -0,0 +1,52 @@
+#include "test/test.h"
+
+#include "cherry/event_pool.h"
+
+#include <set>
+#include <thread>
+#include <vector>
+
+
+namespace cherry {
+namespace test {
+namespace {
+
+struct SameThreadBlock {
+  char data[40];
+};
+
+struct CrossThreadBlock {
+  char data[40];
+};
+
+TEST(EventPool, ReusesReleasedBlock) {
+  using Pool = EventPool<SameThreadBlock>;
+  void* block = Pool::Allocate();
+  Pool::Release(block);
+  void* again = Pool::Allocate();
+  EXPECT_TRUE(again == block);
+  Pool::Release(again);
+}
+
+TEST(EventPool, BlocksReleasedOnAnotherThreadComeBack) {
+  using Pool = EventPool<CrossThreadBlock>;
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < 2 * Pool::kBatchSize; ++i)
+    blocks.push_back(Pool::Allocate());
+  // The releasing thread hands its blocks to the shared list in batches,
+  // and the rest when it exits.
+  std::thread releaser([&blocks]() {
+    for (void* block : blocks)
+      Pool::Release(block);
+  });
+  releaser.join();
+
+  std::set<void*> released(blocks.begin(), blocks.end());
+  void* block = Pool::Allocate();
+  EXPECT_TRUE(released.count(block) != 0);
+  Pool::Release(block);
+}
+
+} // namespace
+} // namespace test
+} // namespace cherry
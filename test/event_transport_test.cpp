@@ -0,0 +1,80 @@
+#include "test/test.h"
+
+#include "cherry/event_macro.h"
+#include "cherry/event_transport.h"
+#include "cherry/shm_ring.h"
+
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+
+EVENT_DEFINE1(TestForwardedEvent, int)
+
+
+namespace cherry {
+namespace test {
+namespace {
+
+// Class ConsumingSink --------------------------------------------------------
+// Handles the forwarded events locally, before the transport could.
+class ConsumingSink {
+public:
+  void OnForwarded(int value) { values_.push_back(value); }
+
+  const std::vector<int>& values() const { return values_; }
+
+private:
+  std::vector<int> values_;
+
+};
+
+TEST(EventTransport, ForwardsEventsHandledLocally) {
+  std::string name = "/cherry_test_" + std::to_string(getpid());
+  std::unique_ptr<EventTransport> transport =
+      EventTransport::Create(name, 1 << 16);
+  ASSERT_TRUE(transport != nullptr);
+  // The ring towards the peer, as the peer opens it.
+  std::unique_ptr<ShmRing> peer = ShmRing::Open(name + ".0");
+  ASSERT_TRUE(peer != nullptr);
+
+  ConsumingSink sink;
+  SubscriptionHandle handle = kInvalidSubscription;
+  RunOn(TaskRunner::EVENT, [&sink, &handle, &transport]() {
+    handle = EventBus::Subscribe<TestForwardedEvent>(
+        &sink, &ConsumingSink::OnForwarded);
+    transport->Forward<TestForwardedEvent>();
+    EXPECT_TRUE(EventBus::FireEventNow(new TestForwardedEvent(0)));
+  });
+  EventBus::Emit<TestForwardedEvent>(1);
+  EventBus::Broadcast(new TestForwardedEvent(2));
+  Drain(TaskRunner::EVENT);
+  EXPECT_EQ(3u, sink.values().size());
+
+  std::vector<int> forwarded;
+  auto decode = [&forwarded](uint32_t tag, const uint8_t* data, size_t size) {
+    EXPECT_EQ(static_cast<uint32_t>(TestForwardedEvent::ID), tag);
+    CodecReader reader(data, size);
+    std::unique_ptr<Event> event(
+        EventCodec<TestForwardedEvent>::Decode(&reader));
+    if (event) {
+      const TestForwardedEvent* value =
+          static_cast<const TestForwardedEvent*>(event.get());
+      forwarded.push_back(std::get<0>(value->param()));
+    }
+  };
+  while (peer->Consume(decode)) {}
+
+  ASSERT_TRUE(forwarded.size() == 3);
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ(i, forwarded[i]);
+  EXPECT_EQ(0u, transport->dropped());
+  RunOn(TaskRunner::EVENT, [handle]() { EventBus::Unsubscribe(handle); });
+  transport.reset();
+}
+
+} // namespace
+} // namespace test
+} // namespace cherry
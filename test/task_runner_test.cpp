@@ -0,0 +1,178 @@
+#include "test/test.h"
+
+#include "cherry/task_runner.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+namespace cherry {
+namespace test {
+namespace {
+
+TEST(TaskRunner, WakesIdleRunner) {
+  std::atomic<int> runs(0);
+  for (int i = 0; i < 3; ++i) {
+    // Gives IO time to fall asleep between posts.
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    TaskRunner::PostTask(TaskRunner::IO, Callback([&runs]() { ++runs; }));
+    int expected = i + 1;
+    EXPECT_TRUE(WaitFor([&runs, expected]() { return runs == expected; }));
+  }
+}
+
+TEST(TaskRunner, PostTasksRunsBatchInOrder) {
+  std::vector<int> order;
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  TaskRunner::PostTask(TaskRunner::IO, Callback([&order]() {
+    order.push_back(0);
+  }));
+  std::vector<Callback> batch;
+  for (int i = 1; i <= 3; ++i)
+    batch.push_back(Callback([&order, i]() { order.push_back(i); }));
+  EXPECT_TRUE(TaskRunner::PostTasks(TaskRunner::IO, std::move(batch)));
+  TaskRunner::PostTask(TaskRunner::IO, Callback([&order]() {
+    order.push_back(4);
+  }));
+  gate.Open();
+  Drain(TaskRunner::IO);
+
+  EXPECT_EQ(5u, order.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    EXPECT_EQ(static_cast<int>(i), order[i]);
+  TaskRunnerMetrics metrics = TaskRunner::GetMetrics(TaskRunner::IO);
+  EXPECT_EQ(3u, metrics.max_batch_size);
+}
+
+TEST(TaskRunner, PostDelayedTasksRunsBatchAfterDelay) {
+  std::atomic<int> runs(0);
+  TimeTicks posted = TimeTicks::Now();
+  std::vector<Callback> batch;
+  for (int i = 0; i < 3; ++i)
+    batch.push_back(Callback([&runs]() { ++runs; }));
+  EXPECT_TRUE(TaskRunner::PostDelayedTasks(TaskRunner::IO, std::move(batch),
+                                           TimeDelta::FromMilliseconds(20)));
+  EXPECT_TRUE(WaitFor([&runs]() { return runs == 3; }));
+  EXPECT_TRUE(TimeTicks::Now() - posted >= TimeDelta::FromMilliseconds(20));
+}
+
+TEST(TaskRunner, ChannelTaskWakesIdleRunner) {
+  std::atomic<int> runs(0);
+  RunOn(TaskRunner::EVENT, []() {
+    EXPECT_TRUE(
+        TaskRunner::OpenChannel(TaskRunner::EVENT, TaskRunner::IO, 16));
+  });
+  for (int i = 0; i < 20; ++i) {
+    // Gives IO time to fall asleep, it is only signaled then.
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    RunOn(TaskRunner::EVENT, [&runs]() {
+      EXPECT_TRUE(TaskRunner::PostChannelTask(
+          TaskRunner::EVENT, TaskRunner::IO, Callback([&runs]() { ++runs; })));
+    });
+    int expected = i + 1;
+    EXPECT_TRUE(WaitFor([&runs, expected]() { return runs == expected; }));
+  }
+}
+
+// Bounces a task between EVENT and IO through channels only, a lost wakeup
+// stalls the rally.
+void Rally(TaskRunner::ID from, TaskRunner::ID to, int remaining,
+           std::atomic<int>* done) {
+  if (remaining == 0) {
+    done->store(1);
+    return;
+  }
+  EXPECT_TRUE(TaskRunner::PostChannelTask(
+      from, to, Bind(&Rally, to, from, remaining - 1, done)));
+}
+
+TEST(TaskRunner, ChannelRallyNeverStalls) {
+  std::atomic<int> done(0);
+  RunOn(TaskRunner::EVENT, []() {
+    TaskRunner::OpenChannel(TaskRunner::EVENT, TaskRunner::IO, 4);
+  });
+  RunOn(TaskRunner::IO, []() {
+    TaskRunner::OpenChannel(TaskRunner::IO, TaskRunner::EVENT, 4);
+  });
+  TaskRunner::PostTask(TaskRunner::EVENT, Bind(&Rally, TaskRunner::EVENT,
+                                               TaskRunner::IO, 20000, &done));
+  EXPECT_TRUE(WaitFor([&done]() { return done == 1; }, 20000));
+}
+
+TEST(TaskRunner, FullChannelLeavesCallback) {
+  std::atomic<int> runs(0);
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  RunOn(TaskRunner::EVENT, [&runs]() {
+    EXPECT_TRUE(TaskRunner::OpenChannel(TaskRunner::EVENT, TaskRunner::IO, 1));
+    EXPECT_FALSE(
+        TaskRunner::OpenChannel(TaskRunner::EVENT, TaskRunner::IO, 1));
+    Callback first([&runs]() { runs += 1; });
+    EXPECT_TRUE(TaskRunner::PostChannelTask(TaskRunner::EVENT, TaskRunner::IO,
+                                            std::move(first)));
+    Callback second([&runs]() { runs += 10; });
+    EXPECT_FALSE(TaskRunner::PostChannelTask(TaskRunner::EVENT,
+                                             TaskRunner::IO,
+                                             std::move(second)));
+    // The callback the full channel refused is still whole.
+    TaskRunner::PostTask(TaskRunner::IO, std::move(second));
+  });
+  gate.Open();
+  EXPECT_TRUE(WaitFor([&runs]() { return runs == 11; }));
+}
+
+TEST(TaskRunner, UrgentTaskRunsBetweenChannelTasks) {
+  const int kChannelTasks = 8;
+  // Only touched on IO until |done| is complete.
+  std::vector<int> order;
+  std::atomic<int> done(0);
+  Gate gate;
+  gate.Hold(TaskRunner::IO);
+  RunOn(TaskRunner::EVENT, [&order, &done]() {
+    EXPECT_TRUE(TaskRunner::OpenChannel(TaskRunner::EVENT, TaskRunner::IO,
+                                        kChannelTasks));
+    for (int i = 0; i < kChannelTasks; ++i) {
+      EXPECT_TRUE(TaskRunner::PostChannelTask(
+          TaskRunner::EVENT, TaskRunner::IO, Callback([&order, &done, i]() {
+            order.push_back(i);
+            ++done;
+            if (i != 0)
+              return;
+            TaskRunner::PostUrgentTask(TaskRunner::IO,
+                                       Callback([&order, &done]() {
+              order.push_back(-1);
+              ++done;
+            }));
+          })));
+    }
+  });
+  gate.Open();
+  EXPECT_TRUE(WaitFor([&done]() { return done == kChannelTasks + 1; }));
+
+  ASSERT_TRUE(order.size() == kChannelTasks + 1);
+  EXPECT_EQ(0, order[0]);
+  EXPECT_EQ(-1, order[1]);
+  for (int i = 1; i < kChannelTasks; ++i)
+    EXPECT_EQ(i, order[i + 1]);
+}
+
+TEST(TaskRunner, DispatchRunnersStartOnDemand) {
+  std::atomic<int> runs(0);
+  EXPECT_FALSE(TaskRunner::DispatchRunnersStarted());
+  TaskRunner::PostTask(TaskRunner::DISPATCH_FIRST,
+                       Callback([&runs]() { ++runs; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(0, runs.load());
+
+  TaskRunner::StartDispatchRunners();
+  TaskRunner::StartDispatchRunners();
+  EXPECT_TRUE(TaskRunner::DispatchRunnersStarted());
+  EXPECT_TRUE(WaitFor([&runs]() { return runs == 1; }));
+}
+
+} // namespace
+} // namespace test
+} // namespace cherry
@@ -0,0 +1,155 @@
+#include "test/test.h"
+
+#include "cherry/event_bus.h"
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace cherry {
+namespace test {
+
+namespace {
+
+struct TestCase {
+  const char* name;
+  TestFunction function;
+};
+
+std::vector<TestCase>& GetTestCases() {
+  static std::vector<TestCase> test_cases;
+  return test_cases;
+}
+
+// Failures of the running test.
+std::mutex g_failures_lock;
+int g_failures = 0;
+
+// Runs on EVENT once the runners are created, starts the driver thread.
+void StartDriver(TestFunction function, std::thread* driver) {
+  *driver = std::thread([function]() {
+    function();
+    TaskRunner::PostTask(TaskRunner::EVENT, Bind(&TaskRunner::StopAll));
+  });
+}
+
+} // namespace
+
+TestRegistrar::TestRegistrar(const char* name, TestFunction function) {
+  GetTestCases().push_back({ name, function });
+}
+
+int RunTests(const std::string& filter) {
+  int failed = 0;
+  int run = 0;
+  for (const TestCase& test_case : GetTestCases()) {
+    if (!filter.empty() &&
+        std::string(test_case.name).find(filter) == std::string::npos) {
+      continue;
+    }
+    printf("[ RUN      ] %s\n", test_case.name);
+    fflush(stdout);
+    {
+      std::lock_guard<std::mutex> guard(g_failures_lock);
+      g_failures = 0;
+    }
+
+    std::thread driver;
+    EventBus::Initialize();
+    TaskRunner::RunAll(Bind(&StartDriver, test_case.function, &driver));
+    driver.join();
+    EventBus::Uninitialize();
+
+    bool passed = false;
+    {
+      std::lock_guard<std::mutex> guard(g_failures_lock);
+      passed = g_failures == 0;
+    }
+    printf("[ %s ] %s\n", passed ? "      OK" : " FAILED ", test_case.name);
+    fflush(stdout);
+    ++run;
+    if (!passed)
+      ++failed;
+  }
+  printf("%d tests run, %d failed\n", run, failed);
+  return failed;
+}
+
+void AddFailure(const char* file, int line, const std::string& message) {
+  std::lock_guard<std::mutex> guard(g_failures_lock);
+  ++g_failures;
+  printf("%s:%d: Failure\n  %s\n", file, line, message.c_str());
+  fflush(stdout);
+}
+
+void RunOn(TaskRunner::ID id, std::function<void()> task) {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool done = false;
+  TaskRunner::PostTask(id, Callback([&]() {
+    task();
+    std::lock_guard<std::mutex> guard(lock);
+    done = true;
+    cv.notify_all();
+  }));
+  std::unique_lock<std::mutex> guard(lock);
+  cv.wait(guard, [&done]() { return done; });
+}
+
+void Drain(TaskRunner::ID id) {
+  RunOn(id, []() {});
+}
+
+bool WaitFor(std::function<bool()> condition, int timeout_ms) {
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() > deadline)
+      return condition();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+
+// Class Gate -----------------------------------------------------------------
+
+struct Gate::State {
+  std::mutex lock;
+  std::condition_variable cv;
+  bool held = false;
+  bool open = false;
+};
+
+Gate::Gate() : state_(new State) {}
+
+Gate::~Gate() {
+  Open();
+}
+
+void Gate::Hold(TaskRunner::ID id) {
+  std::shared_ptr<State> state = state_;
+  TaskRunner::PostTask(id, Callback([state]() {
+    std::unique_lock<std::mutex> guard(state->lock);
+    state->held = true;
+    state->cv.notify_all();
+    state->cv.wait(guard, [&state]() { return state->open; });
+  }));
+  std::unique_lock<std::mutex> guard(state->lock);
+  state->cv.wait(guard, [&state]() { return state->held; });
+}
+
+void Gate::Open() {
+  std::lock_guard<std::mutex> guard(state_->lock);
+  state_->open = true;
+  state_->cv.notify_all();
+}
+
+} // namespace test
+} // namespace cherry
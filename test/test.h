@@ -0,0 +1,110 @@
+#ifndef TEST_TEST_H_
+#define TEST_TEST_H_
+
+#include "cherry/task_runner.h"
+
+#include <functional>
+#include <sstream>
+#include <string>
+
+
+namespace cherry {
+namespace test {
+
+using TestFunction = void (*)();
+
+// Adds a test case during static initialization, see TEST.
+struct TestRegistrar {
+  TestRegistrar(const char* name, TestFunction function);
+};
+
+// Runs the tests whose name contains |filter|, each one on a driver thread
+// with fresh task runners and a fresh EventBus. Returns the number of tests
+// which failed.
+int RunTests(const std::string& filter);
+
+// Records a failure of the running test. Can be called from any thread.
+void AddFailure(const char* file, int line, const std::string& message);
+
+// Runs |task| on runner |id| and blocks the driver thread until it returns.
+void RunOn(TaskRunner::ID id, std::function<void()> task);
+
+// Returns once the tasks posted to runner |id| so far have run.
+void Drain(TaskRunner::ID id);
+
+// Polls |condition| until it holds or |timeout_ms| is over, returns its last
+// value. For results delivered by other runners.
+bool WaitFor(std::function<bool()> condition, int timeout_ms = 5000);
+
+
+// Class Gate -----------------------------------------------------------------
+// Holds a runner busy in a task until opened, so events and tasks pile up
+// behind it.
+class Gate {
+public:
+  Gate();
+  // Opens the gate, a failed test never leaves a runner held.
+  ~Gate();
+
+  Gate(const Gate&) = delete;
+  Gate& operator=(const Gate&) = delete;
+
+  // Posts the holding task to |id| and returns once it runs.
+  void Hold(TaskRunner::ID id);
+  void Open();
+
+private:
+  struct State;
+  std::shared_ptr<State> state_;
+
+};
+
+} // namespace test
+} // namespace cherry
+
+
+#define TEST(suite, name) \
+  static void suite##_##name(); \
+  static const cherry::test::TestRegistrar suite##_##name##_Registrar( \
+      #suite "." #name, &suite##_##name); \
+  static void suite##_##name()
+
+#define EXPECT_TRUE(condition) \
+  do { \
+    if (!(condition)) { \
+      cherry::test::AddFailure(__FILE__, __LINE__, \
+                               "Expected true: " #condition); \
+    } \
+  } while (0)
+
+#define EXPECT_FALSE(condition) \
+  do { \
+    if (condition) { \
+      cherry::test::AddFailure(__FILE__, __LINE__, \
+                               "Expected false: " #condition); \
+    } \
+  } while (0)
+
+#define EXPECT_EQ(expected, actual) \
+  do { \
+    const auto& expected_value = (expected); \
+    const auto& actual_value = (actual); \
+    if (!(expected_value == actual_value)) { \
+      std::ostringstream message; \
+      message << "Expected " #actual " == " << expected_value << ", got " \
+              << actual_value; \
+      cherry::test::AddFailure(__FILE__, __LINE__, message.str()); \
+    } \
+  } while (0)
+
+// Stops the test, or the lambda it is used in, on failure.
+#define ASSERT_TRUE(condition) \
+  do { \
+    if (!(condition)) { \
+      cherry::test::AddFailure(__FILE__, __LINE__, \
+                               "Expected true: " #condition); \
+      return; \
+    } \
+  } while (0)
+
+#endif  // TEST_TEST_H_
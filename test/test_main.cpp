@@ -0,0 +1,12 @@
+// Unit tests of the cherry scheduler and event bus. An optional argument only
+// runs tests whose name contains it, e.g. "cherry_tests EventBus.". The exit
+// code is the number of failed tests.
+
+#include "test/test.h"
+
+#include <string>
+
+
+int main(int argc, char* argv[]) {
+  return cherry::test::RunTests(argc > 1 ? argv[1] : "");
+}
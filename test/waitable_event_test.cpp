@@ -0,0 +1,48 @@
+#include "test/test.h"
+
+#include "cherry/waitable_event.h"
+
+#include <chrono>
+#include <thread>
+
+
+namespace cherry {
+namespace test {
+namespace {
+
+TEST(WaitableEvent, SignalBeforeWaitIsKept) {
+  WaitableEvent event;
+  event.Signal();
+  EXPECT_TRUE(event.TimedWait(TimeDelta::FromSeconds(5)));
+}
+
+TEST(WaitableEvent, ResetsAfterWait) {
+  WaitableEvent event;
+  event.Signal();
+  event.Signal();
+  EXPECT_TRUE(event.TimedWait(TimeDelta::FromSeconds(5)));
+  // Two signals before a wait wake it once.
+  EXPECT_FALSE(event.TimedWait(TimeDelta::FromMilliseconds(10)));
+}
+
+TEST(WaitableEvent, WakesWaitingThread) {
+  WaitableEvent event;
+  std::thread signaler([&event]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    event.Signal();
+  });
+  EXPECT_TRUE(event.TimedWait(TimeDelta::FromSeconds(5)));
+  signaler.join();
+}
+
+TEST(WaitableEvent, TimedWaitUntilPassedDeadline) {
+  WaitableEvent event;
+  TimeTicks passed = TimeTicks::Now() + TimeDelta::FromMilliseconds(-5);
+  EXPECT_FALSE(event.TimedWaitUntil(passed));
+  event.Signal();
+  EXPECT_TRUE(event.TimedWaitUntil(passed));
+}
+
+} // namespace
+} // namespace test
+} // namespace cherry